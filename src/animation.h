@@ -0,0 +1,197 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include "brick.h"
+#include "instances.h"
+
+// Keyframe animation of MagicaVoxel scenes: every model of a file becomes a model of the top level structure and
+// every instance an instance of it. The transforms and models of a frame are sampled on a worker thread while the
+// last frame renders, and applied a frame later to the instances that changed, so only those are refit and uploaded
+class Animator
+{
+public:
+	float fps = 10.0f; // MagicaVoxel frames per second
+	bool playing = true;
+
+	unsigned int changed = 0; // instances the last applied frame changed
+
+	~Animator() {
+		stop();
+	}
+
+	// adds the scene's models and visible instances, offset by position and scaled. instances that aren't
+	// animated are placed once
+	bool load(const char* file_path, instancing::TopLevel& top_level, const glm::vec3& position, float scale) {
+		const ogt_vox_scene* scene = readVoxScene(file_path, k_read_scene_flags_groups | k_read_scene_flags_keyframes);
+		if (!scene) return false;
+
+		scenes_.push_back({ scene, std::vector<int>(scene->num_models) });
+		for (uint32_t i = 0; i < scene->num_models; i++) scenes_.back().models[i] = top_level.addModel(VoxelModel(scene->models[i]));
+
+		for (uint32_t i = 0; i < scene->num_instances; i++) {
+			const ogt_vox_instance* vox_instance = &scene->instances[i];
+			if (vox_instance->hidden || (vox_instance->layer_index < scene->num_layers && scene->layers[vox_instance->layer_index].hidden)) continue;
+
+			Track track = { int(scenes_.size()) - 1, vox_instance, -1 };
+			Sample sample = sample_(scenes_.back(), track, 0);
+
+			instancing::Instance instance;
+			instance.position = position;
+			instance.scale = scale;
+			instance.model = sample.model;
+			instance.animation = sample.transform;
+			track.instance = top_level.addInstance(instance);
+
+			if (animated_(scene, vox_instance)) {
+				tracks_.push_back(track);
+				samples_.push_back(sample);
+			}
+		}
+
+		return true;
+	}
+
+	int trackCount() const {
+		return int(tracks_.size());
+	}
+
+	unsigned int frame() const {
+		return applied_frame_;
+	}
+
+	// applies the sampled frame once the worker finished it and requests the frame at 'time' (seconds).
+	// never waits for the worker, a frame that isn't ready yet is applied on a later call
+	void update(double time, instancing::TopLevel& top_level) {
+		if (tracks_.empty()) return;
+		if (!worker_.joinable()) worker_ = std::thread(&Animator::work_, this);
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (busy_) return;
+
+		if (has_result_) {
+			for (int i : changed_tracks_) {
+				instancing::Instance& instance = top_level.instances[tracks_[i].instance];
+				instance.animation = samples_[i].transform;
+				instance.model = samples_[i].model;
+				top_level.moved(tracks_[i].instance);
+			}
+			changed = (unsigned int)changed_tracks_.size();
+			applied_frame_ = requested_frame_;
+			has_result_ = false;
+		}
+
+		unsigned int frame = (unsigned int)(time * fps);
+		if (frame != requested_frame_) {
+			requested_frame_ = frame;
+			busy_ = true;
+			wake_.notify_one();
+		}
+	}
+
+	void stop() {
+		if (worker_.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				quit_ = true;
+			}
+			wake_.notify_one();
+			worker_.join();
+		}
+
+		for (const Scene& scene : scenes_) ogt_vox_destroy_scene(scene.vox);
+		scenes_.clear();
+		tracks_.clear();
+	}
+
+private:
+	struct Scene {
+		const ogt_vox_scene* vox;
+		std::vector<int> models; // top level model of each of the file's models
+	};
+
+	struct Track {
+		int scene;
+		const ogt_vox_instance* vox_instance;
+		int instance; // in the top level structure
+	};
+
+	struct Sample {
+		glm::mat4 transform;
+		int model;
+	};
+
+	std::vector<Scene> scenes_;
+	std::vector<Track> tracks_;
+
+	// written by the worker while busy_, read by the main thread otherwise
+	std::vector<Sample> samples_;
+	std::vector<int> changed_tracks_;
+
+	std::thread worker_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	bool busy_ = false, has_result_ = false, quit_ = false;
+	unsigned int requested_frame_ = 0, applied_frame_ = 0;
+
+	static bool animated_(const ogt_vox_scene* scene, const ogt_vox_instance* vox_instance) {
+		if (vox_instance->transform_anim.num_keyframes > 1 || vox_instance->model_anim.num_keyframes > 1) return true;
+		for (uint32_t group = vox_instance->group_index; group != k_invalid_group_index && group < scene->num_groups; group = scene->groups[group].parent_group_index)
+			if (scene->groups[group].transform_anim.num_keyframes > 1) return true;
+		return false;
+	}
+
+	// the file's transform moves the model's pivot, floor(size / 2), and is in its z up axes
+	static Sample sample_(const Scene& scene, const Track& track, unsigned int frame) {
+		uint32_t model_index = ogt_vox_sample_instance_model(track.vox_instance, frame);
+		ogt_vox_transform vox_transform = ogt_vox_sample_instance_transform_global(track.vox_instance, frame, scene.vox);
+
+		glm::mat4 transform;
+		std::memcpy(&transform, &vox_transform, sizeof(transform));
+
+		const ogt_vox_model* model = scene.vox->models[model_index];
+		glm::vec3 pivot = glm::floor(glm::vec3(model->size_x, model->size_y, model->size_z) / 2.0f);
+
+		glm::mat4 to_grid(1.0f); // file axes to the grid's, see VoxelModel
+		for (int axis = 0; axis < 3; axis++) {
+			glm::vec3 unit(0.0f);
+			unit[axis] = 1.0f;
+			to_grid[axis] = glm::vec4(VoxelModel::fromFileAxes(unit), 0.0f);
+		}
+
+		transform = to_grid * transform * glm::translate(glm::mat4(1.0f), -pivot) * glm::transpose(to_grid);
+		return { transform, scene.models[model_index] };
+	}
+
+	void work_() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			wake_.wait(lock, [this]() { return busy_ || quit_; });
+			if (quit_) return;
+
+			unsigned int frame = requested_frame_;
+			lock.unlock();
+
+			changed_tracks_.clear();
+			for (size_t i = 0; i < tracks_.size(); i++) {
+				Sample sample = sample_(scenes_[tracks_[i].scene], tracks_[i], frame);
+				if (sample.transform != samples_[i].transform || sample.model != samples_[i].model) {
+					samples_[i] = sample;
+					changed_tracks_.push_back(int(i));
+				}
+			}
+
+			lock.lock();
+			busy_ = false;
+			has_result_ = true;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <functional>
+#include <map>
+#include <iostream>
+#include <iomanip>
+#include "camera.h"
+
+// Flies the camera along a fixed path once per configuration and reports the average frame timings,
+// used to A/B rendering modes on the same scene
+class Benchmark
+{
+public:
+	unsigned int warmup_frames = 60;
+	unsigned int measured_frames = 600;
+
+	struct Config {
+		std::string name;
+		std::function<void()> apply;
+
+		// results
+		double gpu_ms_sum = 0.0;
+		double cpu_ms_sum = 0.0;
+		unsigned int samples = 0;
+		std::map<std::string, double> metric_sums; // averaged over the measured frames like the timings
+	};
+
+	void addConfig(const std::string& name, std::function<void()> apply) {
+		configs_.push_back({ name, apply });
+	}
+
+	void start(const Camera& start_camera) {
+		start_camera_ = start_camera;
+		config_index_ = 0;
+		frame_ = 0;
+		running_ = !configs_.empty();
+		if (running_) configs_[0].apply();
+	}
+
+	bool isRunning() const {
+		return running_;
+	}
+
+	// places the camera for this frame, the path is a slow turn with some bobbing so both
+	// reprojection and disocclusions are exercised
+	void updateCamera(Camera& camera) {
+		float t = float(frame_) / (warmup_frames + measured_frames);
+
+		camera = start_camera_;
+		camera.ProcessMouseMovement(360.0f * t / camera.mouse_sensitivity, 15.0f * glm::sin(t * 6.2831f) / camera.mouse_sensitivity);
+		camera.position += camera.right * 2.0f * glm::sin(t * 6.2831f);
+	}
+
+	// extra per frame numbers to report next to the timings, call before endFrame
+	void addMetric(const std::string& name, double value) {
+		if (running_ && frame_ >= warmup_frames) configs_[config_index_].metric_sums[name] += value;
+	}
+
+	void endFrame(float gpu_ms, float cpu_ms) {
+		if (!running_) return;
+
+		Config& config = configs_[config_index_];
+		if (frame_ >= warmup_frames) {
+			config.gpu_ms_sum += gpu_ms;
+			config.cpu_ms_sum += cpu_ms;
+			config.samples++;
+		}
+
+		if (++frame_ < warmup_frames + measured_frames) return;
+
+		// next configuration
+		frame_ = 0;
+		if (++config_index_ < configs_.size()) configs_[config_index_].apply();
+		else running_ = false;
+	}
+
+	void printResults(std::ostream& out) const {
+		if (configs_.empty() || configs_[0].samples == 0) return;
+
+		const double base_gpu = configs_[0].gpu_ms_sum / configs_[0].samples;
+
+		out << "benchmark: " << measured_frames << " frames per configuration\n";
+		out << std::left << std::setw(24) << "config" << std::setw(12) << "gpu ms" << std::setw(12) << "cpu ms" << std::setw(12) << "speedup";
+		for (const auto& metric : configs_[0].metric_sums) out << std::setw(16) << metric.first;
+		out << "\n";
+
+		for (const Config& config : configs_) {
+			if (config.samples == 0) continue;
+
+			double gpu = config.gpu_ms_sum / config.samples;
+			double cpu = config.cpu_ms_sum / config.samples;
+			out << std::left << std::setw(24) << config.name << std::setw(12) << std::fixed << std::setprecision(3) << gpu
+				<< std::setw(12) << cpu << std::setprecision(2) << base_gpu / gpu << std::setw(11) << "x";
+
+			for (const auto& metric : config.metric_sums) out << std::setw(16) << metric.second / config.samples;
+			out << "\n";
+		}
+		out.flush();
+	}
+
+private:
+	std::vector<Config> configs_;
+	Camera start_camera_;
+	unsigned int config_index_ = 0;
+	unsigned int frame_ = 0;
+	bool running_ = false;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef BLUENOISE_H
+#define BLUENOISE_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+namespace blueNoise {
+	// void and cluster (Ulichney 1993) on a toroidal grid, returns the rank of every pixel remapped to [0, 1)
+	std::vector<float> generate(int size, unsigned int seed) {
+		const int n = size * size;
+		const float sigma = 1.5f;
+
+		// gaussian energy of a point at every toroidal offset
+		std::vector<float> kernel(n);
+		for (int y = 0; y < size; y++) for (int x = 0; x < size; x++) {
+			int dx = std::min(x, size - x), dy = std::min(y, size - y);
+			kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+		}
+
+		std::vector<unsigned char> pattern(n, 0);
+		std::vector<float> energy(n, 0.0f);
+
+		auto splat = [&](int p, float sign) {
+			int px = p % size, py = p / size;
+			for (int y = 0; y < size; y++) {
+				const float* row = &kernel[((y - py + size) % size) * size];
+				for (int x = 0; x < size; x++)
+					energy[y * size + x] += sign * row[(x - px + size) % size];
+			}
+		};
+
+		// tightest cluster among the set pixels, or largest void among the empty ones
+		auto find = [&](bool cluster) {
+			int best = -1;
+			for (int i = 0; i < n; i++) {
+				if (pattern[i] != cluster) continue;
+				if (best == -1 || (cluster ? energy[i] > energy[best] : energy[i] < energy[best])) best = i;
+			}
+			return best;
+		};
+
+		// initial binary pattern, random points relaxed by moving the tightest cluster into the largest void
+		std::mt19937 rng(seed);
+		const int ones = n / 10;
+		for (int placed = 0; placed < ones;) {
+			int p = rng() % n;
+			if (pattern[p]) continue;
+			pattern[p] = 1;
+			splat(p, 1.0f);
+			placed++;
+		}
+
+		for (int i = 0; i < n; i++) {
+			int cluster = find(true);
+			pattern[cluster] = 0;
+			splat(cluster, -1.0f);
+
+			int largest_void = find(false);
+			pattern[largest_void] = 1;
+			splat(largest_void, 1.0f);
+
+			if (largest_void == cluster) break;
+		}
+
+		std::vector<int> rank(n);
+		const std::vector<unsigned char> prototype = pattern;
+		const std::vector<float> prototype_energy = energy;
+
+		// ranks below the prototype: remove the tightest clusters one by one
+		for (int r = ones - 1; r >= 0; r--) {
+			int cluster = find(true);
+			pattern[cluster] = 0;
+			splat(cluster, -1.0f);
+			rank[cluster] = r;
+		}
+
+		// ranks above it: fill the largest voids until the grid is full
+		pattern = prototype;
+		energy = prototype_energy;
+		for (int r = ones; r < n; r++) {
+			int largest_void = find(false);
+			pattern[largest_void] = 1;
+			splat(largest_void, 1.0f);
+			rank[largest_void] = r;
+		}
+
+		std::vector<float> result(n);
+		for (int i = 0; i < n; i++) result[i] = (rank[i] + 0.5f) / n;
+		return result;
+	}
+
+	// two independent blue noise channels (RG16), tiled with GL_REPEAT and bound to 'slot'
+	unsigned int createTexture(int size, unsigned int slot) {
+		std::vector<float> r = generate(size, 1u), g = generate(size, 2u);
+
+		std::vector<unsigned short> data(size * size * 2);
+		for (int i = 0; i < size * size; i++) {
+			data[i * 2 + 0] = (unsigned short)(r[i] * 65535.0f);
+			data[i * 2 + 1] = (unsigned short)(g[i] * 65535.0f);
+		}
+
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, size, size, 0, GL_RG, GL_UNSIGNED_SHORT, data.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+		return texture;
+	}
+}
+
+#endif
@@ -0,0 +1,39 @@
+#version 330 core
+
+out vec3 FragColor;
+
+// illumination and the first hits it was traced from, blurred at their own resolution before the post pass
+// upsamples them
+uniform sampler2D Texture;
+uniform isampler2D IllumNormalTex;
+uniform sampler2D IllumDepthTex;
+
+uniform int BlurSize;
+uniform int Seperation; // texels between the taps
+
+// box blur over the texels of the same surface: same normal and a close first hit
+vec3 boxBlurIllumination(ivec2 loc, int size, int seperation){
+	vec3 accu = vec3(0.);
+	ivec4 normal = texelFetch(IllumNormalTex, loc, 0);
+	float depth = texelFetch(IllumDepthTex, loc, 0).r;
+	int sampleCount = 0;
+
+	for (int i = -size; i <= size; i++){
+			for (int j = -size; j <= size; j++){
+				ivec2 currLoc = loc + ivec2(i, j) * seperation;
+
+				if (texelFetch(IllumNormalTex, currLoc, 0) == normal &&
+						abs(texelFetch(IllumDepthTex, currLoc, 0).r - depth) < 0.1){
+					sampleCount++;
+					accu += texelFetch(Texture, currLoc, 0).rgb;
+				}
+			}
+	}
+
+	return accu / sampleCount;
+}
+
+void main()
+{
+	FragColor = boxBlurIllumination(ivec2(gl_FragCoord.xy), BlurSize, Seperation);
+}
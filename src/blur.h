@@ -0,0 +1,79 @@
+#ifndef BLUR_H
+#define BLUR_H
+
+#include <glad/glad.h>
+#include <iostream>
+#include <algorithm>
+#include "gbuffer.h"
+#include "shader.h"
+
+// Edge aware blur of the traced illumination, run once per frame at the illumination's resolution. The post
+// pass only upsamples the result, so the blur's cost doesn't grow with the window size
+class IlluminationBlur
+{
+public:
+	// (re)creates the target at the illumination's size
+	void resize(int width, int height) {
+		if (width == width_ && height == height_) return;
+		destroy();
+
+		width_ = width;
+		height_ = height;
+
+		// a single frame, nothing accumulates in it
+		const gbuffer::TargetFormat& format = gbuffer::kFrameColorFormat;
+		glGenTextures(1, &texture_);
+		glActiveTexture(GL_TEXTURE0 + kBufferTextureSlot);
+		glBindTexture(GL_TEXTURE_2D, texture_);
+		glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width_, height_, 0, format.format, format.type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &fbo_);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture_, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// blurs the target's illumination, 'indirect_scale' is how many times lower its resolution is than the render
+	// resolution. the taps are spread over about the same screen area at every scale
+	void blur(Shader& shader, const gbuffer::RenderTarget* target, int blur_size, int indirect_scale, unsigned int vao) {
+		resize(target->width, target->height);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+		glViewport(0, 0, width_, height_);
+
+		shader.use();
+		shader.setTexture("Texture", target->textures[SCREEN_TEXTURE], kBufferTextureSlot + SCREEN_TEXTURE);
+		shader.setTexture("IllumNormalTex", target->textures[NORMAL_TEXTURE], kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 0);
+		shader.setTexture("IllumDepthTex", target->textures[DEPTH_TEXTURE], kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 1);
+		shader.setInt("BlurSize", blur_size);
+		shader.setInt("Seperation", std::max(2 / indirect_scale, 1));
+
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+	}
+
+	unsigned int texture() const {
+		return texture_;
+	}
+
+	void destroy() {
+		glDeleteFramebuffers(1, &fbo_);
+		glDeleteTextures(1, &texture_);
+		fbo_ = texture_ = 0;
+		width_ = height_ = 0;
+	}
+
+private:
+	unsigned int fbo_ = 0, texture_ = 0;
+	int width_ = 0, height_ = 0;
+};
+
+#endif
@@ -3,6 +3,9 @@
 
 #define OGT_VOX_IMPLEMENTATION
 #define BRICK_SIZE 8
+#define BRICK_LOD_SIZE 4 // cells along each side of a brick's coarse version
+#define MAP_CELL_BITS 8 // per brick map cell, the map addresses (1 << MAP_CELL_BITS) - 1 bricks
+#define MAP_CELLS_PER_WORD (32 / MAP_CELL_BITS)
 
 #include <glad/glad.h>
 #include <string>
@@ -11,52 +14,124 @@
 #include <iostream>
 #include <io.h>
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include "camera.h"
 #include "ogt_vox.h"
 
+// parse magicavoxel file, read_flags are ogt_vox's k_read_scene_flags
+const ogt_vox_scene* readVoxScene(const char* file_path, uint32_t read_flags = 0) {
+	int err;
+	FILE* fp;
+
+	if ((err = fopen_s(&fp, file_path, "rb")) != 0) {
+		std::cerr << "cannot open file " << file_path << std::endl;
+		return nullptr;
+	}
+
+	uint32_t buffer_size = _filelength(_fileno(fp));
+	uint8_t* buffer = new uint8_t[buffer_size];
+	fread(buffer, buffer_size, 1, fp);
+	fclose(fp);
+
+	const ogt_vox_scene* scene = ogt_vox_read_scene_with_flags(buffer, buffer_size, read_flags);
+	delete[] buffer;
+	return scene;
+}
+
+// a model instance placed in a MagicaVoxel scene's world (z up), at its first frame. the model's voxel v covers
+// transform * (v - pivot), with the pivot at floor(size / 2)
+struct VoxPlacement {
+	const ogt_vox_model* model;
+	glm::mat4 to_model; // world position to the model's voxel
+	glm::ivec3 min, max; // world voxels it covers, max excluded
+
+	VoxPlacement(const ogt_vox_scene* scene, const ogt_vox_instance* instance) {
+		model = scene->models[instance->model_index];
+		ogt_vox_transform vox_transform = ogt_vox_sample_instance_transform_global(instance, 0, scene);
+
+		glm::mat4 transform;
+		std::memcpy(&transform, &vox_transform, sizeof(transform));
+
+		glm::vec3 model_size(model->size_x, model->size_y, model->size_z);
+		transform = transform * glm::translate(glm::mat4(1.0f), -glm::floor(model_size / 2.0f));
+
+		// MagicaVoxel only rotates by multiples of 90 degrees, the corners land on whole voxels
+		min = glm::ivec3(INT_MAX);
+		max = glm::ivec3(INT_MIN);
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 local = glm::vec3(corner & 1, (corner >> 1) & 1, (corner >> 2) & 1) * model_size;
+			glm::ivec3 world = glm::ivec3(glm::round(glm::vec3(transform * glm::vec4(local, 1.0f))));
+			min = glm::min(min, world);
+			max = glm::max(max, world);
+		}
+
+		to_model = glm::inverse(transform);
+	}
+
+	// palette index of the world voxel, 0 outside the model
+	uint8_t sample(int x, int y, int z) const {
+		glm::ivec3 v = glm::ivec3(glm::floor(glm::vec3(to_model * glm::vec4(x + 0.5f, y + 0.5f, z + 0.5f, 1.0f))));
+		if (v.x < 0 || v.y < 0 || v.z < 0 || v.x >= (int)model->size_x || v.y >= (int)model->size_y || v.z >= (int)model->size_z) return 0;
+
+		return model->voxel_data[(v.z * model->size_y + v.y) * model->size_x + v.x];
+	}
+};
+
+// placements of the scene's visible instances and the world bounds around them
+std::vector<VoxPlacement> placeVoxScene(const ogt_vox_scene* scene, glm::ivec3* world_min, glm::ivec3* world_max) {
+	std::vector<VoxPlacement> placements;
+	*world_min = glm::ivec3(INT_MAX);
+	*world_max = glm::ivec3(INT_MIN);
+
+	for (uint32_t i = 0; i < scene->num_instances; i++) {
+		const ogt_vox_instance* instance = &scene->instances[i];
+		if (instance->hidden || (instance->layer_index < scene->num_layers && scene->layers[instance->layer_index].hidden)) continue;
+
+		placements.push_back(VoxPlacement(scene, instance));
+		*world_min = glm::min(*world_min, placements.back().min);
+		*world_max = glm::max(*world_max, placements.back().max);
+	}
+
+	return placements;
+}
+
 class VoxelGrid {
 public:
 	std::vector<uint32_t> data;
 	glm::ivec3 size;
+	unsigned int cell_bits = 4; // bricks and models pack 8 cells to a word, the brick map MAP_CELLS_PER_WORD
 
 public:
 	uint8_t getVoxel(unsigned int x, unsigned int y, unsigned int z) {
 		if (x < 0 || y < 0 || z < 0 || x >= size.x || y >= size.y || z >= size.z)
 			return 0;
 
-		return (data[(z * size.x + x) * size.y / 8 + y / 8] >> ((y % 8) * 4)) & 0xFu;
+		unsigned int per_word = 32 / cell_bits;
+		return (data[(z * size.x + x) * size.y / per_word + y / per_word] >> ((y % per_word) * cell_bits)) & cellMask_();
 	}
 
 	void setVoxel(unsigned int x, unsigned int y, unsigned int z, uint8_t val) {
 		if (x < 0 || y < 0 || z < 0 || x >= size.x || y >= size.y || z >= size.z)
 			return;
-		if (val > 0xFu)
+		if (val > cellMask_())
 			return;
 
-		uint32_t &v = data[(z * size.x + x) * size.y / 8 + y / 8];
+		unsigned int per_word = 32 / cell_bits;
+		uint32_t &v = data[(z * size.x + x) * size.y / per_word + y / per_word];
 
-		v = (v & ~(0xFu << ((y % 8) * 4))) | (val << ((y % 8) * 4));
+		v = (v & ~(cellMask_() << ((y % per_word) * cell_bits))) | (uint32_t(val) << ((y % per_word) * cell_bits));
 	}
 
 protected:
-	// parse magicavoxel file
-	const ogt_vox_scene* readScene_(const char* file_path) {
-		int err;
-		FILE* fp;
-
-		if ((err = fopen_s(&fp, file_path, "rb")) != 0) {
-			std::cerr << "cannot open file " << file_path << std::endl;
-			return nullptr;
-		}
-
-		uint32_t buffer_size = _filelength(_fileno(fp));
-		uint8_t* buffer = new uint8_t[buffer_size];
-		fread(buffer, buffer_size, 1, fp);
-		fclose(fp);
+	uint32_t cellMask_() const {
+		return (1u << cell_bits) - 1u;
+	}
 
-		const ogt_vox_scene* scene = ogt_vox_read_scene(buffer, buffer_size);
-		delete[] buffer;
-		return scene;
+	const ogt_vox_scene* readScene_(const char* file_path, uint32_t read_flags = 0) {
+		return readVoxScene(file_path, read_flags);
 	}
 
 	void encodeData_(const uint8_t* voxel_data, unsigned int size_x, unsigned int size_y, unsigned int size_z) {
@@ -89,35 +164,126 @@ public:
 	glm::vec3 env_color;
 	Camera camera;
 
-	// read brickmap from MagicaVoxel file
+	// read brickmap from MagicaVoxel file. every visible instance of the file's scene is stitched into one map, so
+	// worlds can be larger than MagicaVoxel's 256^3 models. the height is padded to a multiple of 8
 	BrickMap(const char* file_path) {
-		const ogt_vox_scene* scene = readScene_(file_path);
+		const ogt_vox_scene* scene = readScene_(file_path, k_read_scene_flags_groups);
 		if (!scene) return;
 
-		const ogt_vox_model* model = scene->models[0];
+		glm::ivec3 world_min, world_max;
+		std::vector<VoxPlacement> placements = placeVoxScene(scene, &world_min, &world_max);
 
-		size = glm::ivec3(model->size_x, model->size_z, model->size_y);
-
-		if (size.y % 8 != 0) {
-			std::cerr << file_path << ": brickmap's height has to be a multiple of 8." << std::endl;
+		if (placements.empty()) {
+			std::cerr << file_path << ": no visible models." << std::endl;
 			ogt_vox_destroy_scene(scene);
 			return;
 		}
 
-		data = std::vector<uint32_t>(size.x * size.y * size.z / 8);
-		encodeData_(model->voxel_data, size.x, size.y, size.z);
+		resize_(world_max - world_min);
+		stitch_(placements, world_min);
+		readSettings_(scene, world_min, 1);
+
+		ogt_vox_destroy_scene(scene);
+	}
+
+	// empty map for a scene whose voxels are split into bricks (see brickify.h), voxels_per_cell voxels per brick
+	// along each axis. the sky color and camera are read from the scene
+	BrickMap(const ogt_vox_scene* scene, const glm::ivec3& world_min, const glm::ivec3& world_max, int voxels_per_cell) {
+		resize_((world_max - world_min + voxels_per_cell - 1) / voxels_per_cell);
+		readSettings_(scene, world_min, voxels_per_cell);
+	}
+
+	// empty map, filled in place (see minecraft.h). the height is padded to a multiple of 8. a paged map's cells
+	// are kept by the pager (see paging.h), it isn't allocated here
+	BrickMap(const glm::ivec3& map_size, bool allocate = true) : env_color(0.0f) {
+		cell_bits = MAP_CELL_BITS;
+		size = glm::ivec3(map_size.x, (map_size.y + 7) / 8 * 8, map_size.z);
+		if (allocate) data = std::vector<uint32_t>(size_t(size.x) * size.y * size.z / MAP_CELLS_PER_WORD);
+	}
+
+private:
+	// extent in the file's axes, x along the file's x, y up along its z and z along its y
+	void resize_(const glm::ivec3& extent) {
+		cell_bits = MAP_CELL_BITS;
+		size = glm::ivec3(extent.x, (extent.z + 7) / 8 * 8, extent.y);
+		data = std::vector<uint32_t>(size_t(size.x) * size.y * size.z / MAP_CELLS_PER_WORD);
+	}
 
+	void readSettings_(const ogt_vox_scene* scene, const glm::ivec3& world_min, int voxels_per_cell) {
 		env_color = glm::vec3(scene->palette.color[255].r, scene->palette.color[255].g, scene->palette.color[255].b) * scene->materials.matl[255].emit * (float)pow(10, scene->materials.matl[255].flux) / 255.0f;
 
 		// calculate saved camera position from file
-		ogt_vox_cam vox_cam = scene->cameras[0];
-		glm::vec3 angles(vox_cam.angle[0], -vox_cam.angle[1], vox_cam.angle[2]);
-		glm::vec3 cam_front(
-			cos(glm::radians(angles.x)) * sin(glm::radians(angles.y)),
-			sin(glm::radians(angles.x)),
-			cos(glm::radians(angles.x)) * cos(glm::radians(angles.y)));
-		glm::vec3 cam_pos = glm::vec3(vox_cam.focus[0] + (float)size.x / 2.0f, vox_cam.focus[2], vox_cam.focus[1] + (float)size.z / 2.0f) - glm::vec3(vox_cam.radius) * cam_front;
-		camera = Camera(cam_pos, { {0.0f},{1.0f},{0.0f} }, angles.y, angles.x);
+		if (scene->num_cameras > 0) {
+			ogt_vox_cam vox_cam = scene->cameras[0];
+			glm::vec3 angles(vox_cam.angle[0], -vox_cam.angle[1], vox_cam.angle[2]);
+			glm::vec3 cam_front(
+				cos(glm::radians(angles.x)) * sin(glm::radians(angles.y)),
+				sin(glm::radians(angles.x)),
+				cos(glm::radians(angles.x)) * cos(glm::radians(angles.y)));
+			glm::vec3 focus = glm::vec3(vox_cam.focus[0] - world_min.x, vox_cam.focus[2] - world_min.z, vox_cam.focus[1] - world_min.y);
+			glm::vec3 cam_pos = (focus - glm::vec3(vox_cam.radius) * cam_front) / float(voxels_per_cell);
+			camera = Camera(cam_pos, { {0.0f},{1.0f},{0.0f} }, angles.y, angles.x);
+		}
+	}
+
+	// writes the placements straight into the packed data. the threads take interleaved z rows of the map, no
+	// packed word spans two rows so no two threads write the same one. placements that overlap are written in
+	// file order, the later one wins where it has voxels
+	void stitch_(const std::vector<VoxPlacement>& placements, const glm::ivec3& world_min) {
+		int thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+		std::vector<std::thread> threads;
+
+		for (int t = 0; t < thread_count; t++) threads.emplace_back([&, t]() {
+			for (const VoxPlacement& placement : placements) {
+				int first = placement.min.y + ((t - (placement.min.y - world_min.y)) % thread_count + thread_count) % thread_count;
+
+				for (int wy = first; wy < placement.max.y; wy += thread_count)
+					for (int wx = placement.min.x; wx < placement.max.x; wx++)
+						for (int wz = placement.min.z; wz < placement.max.z; wz++) {
+							uint8_t voxel = placement.sample(wx, wy, wz);
+							if (voxel) setVoxel(wx - world_min.x, wz - world_min.z, wy - world_min.y, voxel);
+						}
+			}
+		});
+
+		for (std::thread& thread : threads) thread.join();
+	}
+};
+
+// free standing grid of bricks, placed in the scene as instances (see instances.h). like in the brick map its
+// palette indices are the scene's bricks, the height is padded to a multiple of 8
+class VoxelModel : public VoxelGrid
+{
+public:
+	// read model from MagicaVoxel file
+	VoxelModel(const char* file_path) {
+		const ogt_vox_scene* scene = readScene_(file_path);
+		if (!scene) return;
+
+		load_(scene->models[0]);
+		ogt_vox_destroy_scene(scene);
+	}
+
+	// one model of an already parsed file
+	VoxelModel(const ogt_vox_model* model) {
+		load_(model);
+	}
+
+	// position of a voxel of the file in the grid, see load_
+	static glm::vec3 fromFileAxes(const glm::vec3& v) {
+		return glm::vec3(v.x, v.z, v.y);
+	}
+
+private:
+	void load_(const ogt_vox_model* model) {
+		// same axes as the brick map: x along the file's x, y up along its z and z along its y
+		size = glm::ivec3(model->size_x, (model->size_z + 7) / 8 * 8, model->size_y);
+		data = std::vector<uint32_t>(size.x * size.y * size.z / 8);
+
+		for (unsigned int z = 0; z < model->size_z; z++)
+			for (unsigned int y = 0; y < model->size_y; y++)
+				for (unsigned int x = 0; x < model->size_x; x++)
+					setVoxel(x, z, y, model->voxel_data[(z * model->size_y + y) * model->size_x + x]);
 	}
 };
 
@@ -126,10 +292,21 @@ struct Material
 	uint32_t color = 0;
 	uint16_t emission = 0;
 	uint8_t roughness = 0;
+	uint8_t max_depth = 0; // bounce after which paths hitting this material end, 0 (the default) for no limit
 
 	Material() {}
 
 	Material(uint32_t _color, uint16_t _emission, uint16_t _roughness) : color(_color), emission(_emission), roughness(_roughness) {}
+
+	// palette entry of a MagicaVoxel scene
+	Material(const ogt_vox_scene* scene, uint8_t index) {
+		ogt_vox_rgba ogt_color = scene->palette.color[index];
+		ogt_vox_matl ogt_material = scene->materials.matl[index];
+
+		color = (unsigned int)(ogt_color.r) << 16 | (unsigned int)(ogt_color.g) << 8 | (unsigned int)(ogt_color.b);
+		emission = ogt_material.emit * 100.0f * pow(10, ogt_material.flux);
+		roughness = ogt_material.rough * 0xFF;
+	}
 };
 
 class Brick : public VoxelGrid
@@ -137,6 +314,36 @@ class Brick : public VoxelGrid
 public:
 	std::vector<Material> mats;
 
+	// empty brick, filled in place (see brickify.h)
+	Brick() {
+		size = glm::ivec3(BRICK_SIZE);
+		data = std::vector<uint32_t>(BRICK_SIZE * BRICK_SIZE * BRICK_SIZE / 8);
+		mats.push_back(Material(0, 0, 0));
+	}
+
+	// coarse version of the brick for distant and secondary rays, packed 8 cells to a word at
+	// (z * BRICK_LOD_SIZE + x) * BRICK_LOD_SIZE + y. a cell is filled when at least half of its voxels are, with their
+	// most common material, so walls and floors one voxel thick are kept
+	std::vector<uint32_t> lodData() {
+		const int cell_size = BRICK_SIZE / BRICK_LOD_SIZE;
+		const int cell_voxels = cell_size * cell_size * cell_size;
+		std::vector<uint32_t> words(BRICK_LOD_SIZE * BRICK_LOD_SIZE * BRICK_LOD_SIZE / 8, 0);
+
+		for (int z = 0; z < BRICK_LOD_SIZE; z++) for (int x = 0; x < BRICK_LOD_SIZE; x++) for (int y = 0; y < BRICK_LOD_SIZE; y++) {
+			int counts[16] = { 0 };
+			for (int i = 0; i < cell_voxels; i++)
+				counts[getVoxel(x * cell_size + i / cell_size % cell_size, y * cell_size + i % cell_size, z * cell_size + i / (cell_size * cell_size))]++;
+
+			if ((cell_voxels - counts[0]) * 2 < cell_voxels) continue;
+
+			int mat = int(std::max_element(counts + 1, counts + 16) - counts);
+			int cell = (z * BRICK_LOD_SIZE + x) * BRICK_LOD_SIZE + y;
+			words[cell / 8] |= uint32_t(mat) << (cell % 8 * 4);
+		}
+
+		return words;
+	}
+
 	// read brick from MagicaVoxel file
 	Brick(const char* file_path) {
 		const ogt_vox_scene* scene = readScene_(file_path);
@@ -167,16 +374,7 @@ public:
 			if (pallet_to_my_mat[voxel_data[i]] != 0) // already found
 				voxel_data[i] = pallet_to_my_mat[voxel_data[i]];
 			else { // assign new material
-				ogt_vox_rgba ogt_color = scene->palette.color[voxel_data[i]];
-				ogt_vox_matl ogt_material = scene->materials.matl[voxel_data[i]];
-
-				Material mat(
-					(unsigned int)(ogt_color.r) << 16 | (unsigned int)(ogt_color.g) << 8 | (unsigned int)(ogt_color.b), // color
-					ogt_material.emit * 100.0f * pow(10, ogt_material.flux), // emission
-					ogt_material.rough * 0xFF // roughness
-				);
-
-				mats.push_back(mat);
+				mats.push_back(Material(scene, voxel_data[i]));
 
 				pallet_to_my_mat[voxel_data[i]] = mats.size() - 1;
 				voxel_data[i] = mats.size() - 1;
@@ -0,0 +1,236 @@
+#ifndef BRICKIFY_H
+#define BRICKIFY_H
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cfloat>
+#include <chrono>
+#include "brick.h"
+
+// Splits a full resolution MagicaVoxel scene into 8^3 bricks: every brick is reduced to at most 15 palette entries,
+// identical bricks are found by a hash of their voxels and shared, and the map cells point at them. The cells are
+// split on all cores, each thread deduplicating its own rows before the tables are merged. A model with more
+// distinct bricks than the map can address isn't imported
+class Brickifier
+{
+public:
+	static const int kMaxBricks = (1 << MAP_CELL_BITS) - 1;
+	static const int kMaxMaterials = 15;
+
+	std::unique_ptr<BrickMap> map;
+	std::vector<std::unique_ptr<Brick>> bricks;
+
+	// stats of the last import
+	unsigned int filled_cells = 0, unique_bricks = 0;
+	float import_ms = 0.0f;
+
+	bool import(const char* file_path) {
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const ogt_vox_scene* scene = readVoxScene(file_path, k_read_scene_flags_groups);
+		if (!scene) return false;
+
+		glm::ivec3 world_min, world_max;
+		std::vector<VoxPlacement> placements = placeVoxScene(scene, &world_min, &world_max);
+
+		if (placements.empty()) {
+			std::cerr << file_path << ": no visible models." << std::endl;
+			ogt_vox_destroy_scene(scene);
+			return false;
+		}
+
+		map = std::unique_ptr<BrickMap>(new BrickMap(scene, world_min, world_max, BRICK_SIZE));
+
+		// split, every thread takes interleaved z rows of the map
+		int thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+		std::vector<Table_> tables(thread_count);
+		std::vector<int> cell_bricks(size_t(map->size.x) * map->size.y * map->size.z, -1); // in the table of the cell's thread
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < thread_count; t++)
+			threads.emplace_back(&Brickifier::split_, this, scene, std::cref(placements), world_min, t, thread_count, std::ref(tables[t]), std::ref(cell_bricks));
+		for (std::thread& thread : threads) thread.join();
+
+		// merge the threads' tables
+		Table_ table;
+		std::vector<std::vector<int>> merged(thread_count);
+		for (int t = 0; t < thread_count; t++)
+			for (const Content_& content : tables[t].contents) merged[t].push_back(table.add(content, content.uses));
+
+		unique_bricks = (unsigned int)table.contents.size();
+		if (unique_bricks > kMaxBricks) {
+			std::cerr << file_path << ": " << unique_bricks << " distinct bricks, the map can only address " << kMaxBricks << "." << std::endl;
+			ogt_vox_destroy_scene(scene);
+			return false;
+		}
+
+		bricks.clear();
+		for (const Content_& content : table.contents) bricks.push_back(std::unique_ptr<Brick>(build_(scene, content)));
+
+		filled_cells = 0;
+		for (int z = 0; z < map->size.z; z++) for (int x = 0; x < map->size.x; x++) for (int y = 0; y < map->size.y; y++) {
+			int brick = cell_bricks[cell_(x, y, z)];
+			if (brick < 0) continue;
+
+			map->setVoxel(x, y, z, merged[z % thread_count][brick] + 1);
+			filled_cells++;
+		}
+
+		ogt_vox_destroy_scene(scene);
+
+		import_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return true;
+	}
+
+private:
+	static const int kBrickVoxels = BRICK_SIZE * BRICK_SIZE * BRICK_SIZE;
+
+	// palette indices of a brick's voxels, at (z * 8 + x) * 8 + y
+	struct Content_ {
+		uint8_t voxels[kBrickVoxels];
+		uint64_t hash;
+		unsigned int uses;
+	};
+
+	// deduplicated bricks, by content
+	struct Table_ {
+		std::vector<Content_> contents;
+		std::unordered_multimap<uint64_t, int> index;
+
+		int add(const Content_& content, unsigned int uses) {
+			auto range = index.equal_range(content.hash);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (std::memcmp(contents[it->second].voxels, content.voxels, kBrickVoxels) != 0) continue;
+
+				contents[it->second].uses += uses;
+				return it->second;
+			}
+
+			contents.push_back(content);
+			contents.back().uses = uses;
+			index.emplace(content.hash, int(contents.size()) - 1);
+			return int(contents.size()) - 1;
+		}
+	};
+
+	size_t cell_(int x, int y, int z) const {
+		return (size_t(z) * map->size.x + x) * map->size.y + y;
+	}
+
+	void split_(const ogt_vox_scene* scene, const std::vector<VoxPlacement>& placements, glm::ivec3 world_min, int thread, int thread_count, Table_& table, std::vector<int>& cell_bricks) {
+		Content_ content;
+
+		for (int z = thread; z < map->size.z; z += thread_count) for (int x = 0; x < map->size.x; x++) for (int y = 0; y < map->size.y; y++) {
+			// the cell's voxels in the file's world, z up
+			glm::ivec3 low = world_min + glm::ivec3(x, z, y) * BRICK_SIZE;
+			glm::ivec3 high = low + BRICK_SIZE;
+
+			std::memset(content.voxels, 0, kBrickVoxels);
+			bool filled = false;
+
+			// later placements win where they have voxels, like in the stitched map
+			for (const VoxPlacement& placement : placements) {
+				if (glm::any(glm::greaterThanEqual(low, placement.max)) || glm::any(glm::lessThanEqual(high, placement.min))) continue;
+
+				for (int i = 0; i < kBrickVoxels; i++) {
+					int bx = i / BRICK_SIZE % BRICK_SIZE, by = i % BRICK_SIZE, bz = i / (BRICK_SIZE * BRICK_SIZE);
+					uint8_t voxel = placement.sample(low.x + bx, low.y + bz, low.z + by);
+					if (!voxel) continue;
+
+					content.voxels[i] = voxel;
+					filled = true;
+				}
+			}
+
+			if (!filled) continue;
+
+			quantize_(scene, content);
+			content.hash = hash_(content);
+			cell_bricks[cell_(x, y, z)] = table.add(content, 1);
+		}
+	}
+
+	// merges the closest palette entries of the brick until it uses at most kMaxMaterials
+	static void quantize_(const ogt_vox_scene* scene, Content_& content) {
+		unsigned int counts[256] = { 0 };
+		for (int i = 0; i < kBrickVoxels; i++) counts[content.voxels[i]]++;
+
+		std::vector<int> used;
+		for (int i = 1; i < 256; i++) if (counts[i]) used.push_back(i);
+		if (used.size() <= kMaxMaterials) return;
+
+		uint8_t remap[256];
+		for (int i = 0; i < 256; i++) remap[i] = uint8_t(i);
+
+		while (used.size() > kMaxMaterials) {
+			size_t best_a = 0, best_b = 1;
+			float best_distance = FLT_MAX;
+			for (size_t a = 0; a < used.size(); a++) for (size_t b = a + 1; b < used.size(); b++) {
+				float distance = paletteDistance_(scene, used[a], used[b]);
+				if (distance < best_distance) {
+					best_distance = distance;
+					best_a = a;
+					best_b = b;
+				}
+			}
+
+			// the more used entry stays
+			if (counts[used[best_a]] < counts[used[best_b]]) std::swap(best_a, best_b);
+			int from = used[best_b], to = used[best_a];
+			counts[to] += counts[from];
+			for (int i = 0; i < 256; i++) if (remap[i] == from) remap[i] = uint8_t(to);
+			used.erase(used.begin() + best_b);
+		}
+
+		for (int i = 0; i < kBrickVoxels; i++) content.voxels[i] = remap[content.voxels[i]];
+	}
+
+	static float paletteDistance_(const ogt_vox_scene* scene, int a, int b) {
+		const ogt_vox_rgba& color_a = scene->palette.color[a];
+		const ogt_vox_rgba& color_b = scene->palette.color[b];
+		const ogt_vox_matl& matl_a = scene->materials.matl[a];
+		const ogt_vox_matl& matl_b = scene->materials.matl[b];
+
+		glm::vec3 color = glm::vec3(color_a.r, color_a.g, color_a.b) - glm::vec3(color_b.r, color_b.g, color_b.b);
+		float emission = (matl_a.emit * (float)pow(10, matl_a.flux) - matl_b.emit * (float)pow(10, matl_b.flux)) * 255.0f;
+		float roughness = (matl_a.rough - matl_b.rough) * 255.0f;
+		return glm::dot(color, color) + emission * emission + roughness * roughness;
+	}
+
+	// FNV-1a
+	static uint64_t hash_(const Content_& content) {
+		uint64_t hash = 14695981039346656037ull;
+		for (int i = 0; i < kBrickVoxels; i++) {
+			hash ^= content.voxels[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static Brick* build_(const ogt_vox_scene* scene, const Content_& content) {
+		Brick* brick = new Brick();
+		uint8_t palette_to_mat[256] = { 0 };
+
+		for (int i = 0; i < kBrickVoxels; i++) {
+			uint8_t voxel = content.voxels[i];
+			if (!voxel) continue;
+
+			if (!palette_to_mat[voxel]) {
+				brick->mats.push_back(Material(scene, voxel));
+				palette_to_mat[voxel] = uint8_t(brick->mats.size() - 1);
+			}
+
+			brick->setVoxel(i / BRICK_SIZE % BRICK_SIZE, i % BRICK_SIZE, i / (BRICK_SIZE * BRICK_SIZE), palette_to_mat[voxel]);
+		}
+
+		return brick;
+	}
+};
+
+#endif
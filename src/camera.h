@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <functional>
 #include "mathutil.h"
+#include "collision.h"
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement {
@@ -44,6 +45,7 @@ public:
 	// camera options
 	float jump_force = 1.2f;
 	float collider_half_width = 0.05f;
+	float step_height = 0.13f; // a voxel and a bit, ledges up to this are walked onto
 
 	float movement_speed;
 	float mouse_sensitivity;
@@ -76,43 +78,70 @@ public:
 		return glm::lookAt(position, position + front, up);
 	}
 
-	void Update(float delta_time, std::function<bool(const glm::vec3)> isPositionOccupied, glm::ivec3 grid_size) {
+	void Update(float delta_time, collision::VoxelCollider& collider) {
 		if (no_clip) return;
 
 		if (!is_grounded) {
 			y_vel -= GRAVITY * delta_time;
 		}
 
-		Move(glm::vec3(0.0f, glm::sign(y_vel), 0.0f), glm::abs(y_vel) * delta_time, isPositionOccupied, grid_size);
+		Move(glm::vec3(0.0f, glm::sign(y_vel), 0.0f), glm::abs(y_vel) * delta_time, collider);
 
 		//std::cout << y_vel << "\n";
 	}
 
 	// processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
-	void ProcessKeyboard(Camera_Movement direction, float delta_time, std::function<bool(const glm::vec3)> isPositionOccupied, glm::ivec3 grid_size)
+	void ProcessKeyboard(Camera_Movement direction, float delta_time, collision::VoxelCollider& collider)
 	{
 		float move_amount = movement_speed * delta_time;
 
 		if (direction == FORWARD)
-			Move(glm::normalize(glm::cross(right, world_up)), move_amount, isPositionOccupied, grid_size);
+			Move(glm::normalize(glm::cross(right, world_up)), move_amount, collider);
 		if (direction == BACKWARD)
-			Move(-glm::normalize(glm::cross(right, world_up)), move_amount, isPositionOccupied, grid_size);
+			Move(-glm::normalize(glm::cross(right, world_up)), move_amount, collider);
 		if (direction == LEFT)
-			Move(-right, move_amount, isPositionOccupied, grid_size);
+			Move(-right, move_amount, collider);
 		if (direction == RIGHT)
-			Move(right, move_amount, isPositionOccupied, grid_size);
+			Move(right, move_amount, collider);
 		if (!no_clip && direction == UP && is_grounded)
 			y_vel = jump_force;
 
 		if (!no_clip) return;
 
 		if (direction == DOWN)
-			Move(-world_up, move_amount, isPositionOccupied, grid_size);
+			Move(-world_up, move_amount, collider);
 		if (direction == UP)
-			Move(world_up, move_amount, isPositionOccupied, grid_size);
+			Move(world_up, move_amount, collider);
 	}
 
-	void Move(glm::vec3 dir, float amount, std::function<bool(const glm::vec3)> isPositionOccupied, glm::ivec3 grid_size)
+	// moves the camera's collider box through the voxels, sliding along walls and stepping up ledges
+	void Move(glm::vec3 dir, float amount, collision::VoxelCollider& collider)
+	{
+		if (no_clip) {
+			position += normalize(dir) * amount;
+			return;
+		}
+
+		collision::Body body;
+		body.position = position;
+		body.half_extents = glm::vec3(collider_half_width);
+		body.step_height = step_height;
+		body.grounded = is_grounded;
+
+		glm::vec3 delta = dir == glm::vec3(0.0f) ? glm::vec3(0.0f) : glm::normalize(dir) * amount;
+		collider.move(body, delta);
+		position = body.position;
+
+		if ((!is_grounded && body.grounded) || (!is_head_bump && body.head_bump)) {
+			y_vel = 0.0f;
+		}
+		is_grounded = body.grounded;
+		is_head_bump = body.head_bump;
+	}
+
+	// the previous mover, ray casts from the collider's corners and backs off until the position is free.
+	// only kept to compare against in the collision benchmark
+	void MoveRayCast(glm::vec3 dir, float amount, std::function<bool(const glm::vec3)> isPositionOccupied, glm::ivec3 grid_size)
 	{
 		if (no_clip) {
 			position += normalize(dir) * amount;
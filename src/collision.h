@@ -0,0 +1,147 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+#include <functional>
+#include <cmath>
+
+namespace collision {
+	// axis aligned box moving through the voxel grid, position is its center
+	struct Body {
+		glm::vec3 position = glm::vec3(0.0f);
+		glm::vec3 half_extents = glm::vec3(0.5f);
+		float step_height = 0.0f; // ledges up to this high are walked onto while grounded
+
+		// contacts after the last move
+		bool grounded = false;
+		bool head_bump = false;
+	};
+
+	struct MoveResult {
+		glm::vec3 moved; // displacement actually applied
+		glm::bvec3 blocked; // axes the movement was stopped on
+		bool stepped;
+	};
+
+	// Swept AABB against the voxel grid: a move is resolved one axis at a time, and each axis only tests the slabs
+	// of voxels the box's leading face passes, so the blocked axes stop at the first solid voxel and the rest of the
+	// move slides along it. Holds no per body state, one collider serves any number of bodies.
+	class VoxelCollider
+	{
+	public:
+		float skin = 0.0005f; // gap kept to the surfaces, so touching faces don't count as overlaps
+		float contact_probe = 0.01f; // how close a surface has to be to count as ground or ceiling
+
+		unsigned long long voxels_tested = 0; // running count, for benchmarking
+
+		VoxelCollider() {}
+
+		// is_occupied gets a position inside the voxel, voxel_size is its edge and grid_size the voxels per axis.
+		// everything outside the grid is empty
+		VoxelCollider(std::function<bool(const glm::vec3)> is_occupied, float voxel_size, glm::ivec3 grid_size)
+			: is_occupied_(is_occupied), voxel_size_(voxel_size), grid_size_(grid_size) {}
+
+		// moves the body by delta as far as it can, sliding along what it hits and stepping up ledges
+		MoveResult move(Body& body, const glm::vec3& delta) {
+			MoveResult result = { glm::vec3(0.0f), glm::bvec3(false), false };
+			glm::vec3 start = body.position;
+
+			// vertical first, so a falling body lands before sliding along the floor
+			const int order[3] = { 1, 0, 2 };
+			for (int axis : order) {
+				bool blocked = false;
+				body.position[axis] += sweep(body.position, body.half_extents, axis, delta[axis], &blocked);
+				result.blocked[axis] = blocked;
+			}
+
+			// walking into a ledge: try the horizontal move again from step_height higher and settle back down
+			if (body.step_height > 0.0f && body.grounded && (result.blocked.x || result.blocked.z)) {
+				glm::vec3 stepped = start;
+				float up = sweep(stepped, body.half_extents, 1, body.step_height, nullptr);
+				stepped.y += up;
+
+				glm::bvec3 blocked(false);
+				for (int axis = 0; axis < 3; axis += 2) {
+					bool axis_blocked = false;
+					stepped[axis] += sweep(stepped, body.half_extents, axis, delta[axis], &axis_blocked);
+					blocked[axis] = axis_blocked;
+				}
+				stepped.y += sweep(stepped, body.half_extents, 1, -up + glm::min(delta.y, 0.0f), nullptr);
+
+				float flat_progress = glm::length(glm::vec2(body.position.x - start.x, body.position.z - start.z));
+				float step_progress = glm::length(glm::vec2(stepped.x - start.x, stepped.z - start.z));
+				if (step_progress > flat_progress + skin) {
+					body.position = stepped;
+					result.blocked = blocked;
+					result.stepped = true;
+				}
+			}
+
+			updateContacts(body);
+
+			result.moved = body.position - start;
+			return result;
+		}
+
+		// refreshes grounded and head_bump without moving
+		void updateContacts(Body& body) {
+			sweep(body.position, body.half_extents, 1, -contact_probe, &body.grounded);
+			sweep(body.position, body.half_extents, 1, contact_probe, &body.head_bump);
+		}
+
+		// signed distance the box can move along axis (up to distance) before its leading face reaches a solid voxel
+		float sweep(const glm::vec3& center, const glm::vec3& half_extents, int axis, float distance, bool* blocked) {
+			if (blocked) *blocked = false;
+			if (distance == 0.0f) return 0.0f;
+
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+			// voxels under the box's cross section, clipped to the grid
+			int u0 = glm::max(cell_(center[u] - half_extents[u] + skin), 0), u1 = glm::min(cell_(center[u] + half_extents[u] - skin), grid_size_[u] - 1);
+			int v0 = glm::max(cell_(center[v] - half_extents[v] + skin), 0), v1 = glm::min(cell_(center[v] + half_extents[v] - skin), grid_size_[v] - 1);
+			if (u0 > u1 || v0 > v1) return distance;
+
+			// slabs the leading face enters, the ones the box already overlaps are ignored so a stuck body can get out
+			int step = distance > 0.0f ? 1 : -1;
+			float face = center[axis] + step * half_extents[axis];
+			int first = cell_(face - step * skin) + step;
+			int last = cell_(face + distance - step * skin);
+
+			for (int slab = first; step * (last - slab) >= 0; slab += step) {
+				if (step > 0 ? slab >= grid_size_[axis] : slab < 0) break; // left the grid, nothing more to hit
+				if (slab < 0 || slab >= grid_size_[axis]) continue; // not in the grid yet
+
+				for (int i = u0; i <= u1; i++) for (int j = v0; j <= v1; j++) {
+					glm::ivec3 voxel;
+					voxel[axis] = slab;
+					voxel[u] = i;
+					voxel[v] = j;
+					if (!occupied_(voxel)) continue;
+
+					if (blocked) *blocked = true;
+					float boundary = (step > 0 ? slab : slab + 1) * voxel_size_;
+					float allowed = boundary - face - step * skin;
+					return step > 0 ? glm::clamp(allowed, 0.0f, distance) : glm::clamp(allowed, distance, 0.0f);
+				}
+			}
+
+			return distance;
+		}
+
+	private:
+		std::function<bool(const glm::vec3)> is_occupied_;
+		float voxel_size_ = 1.0f;
+		glm::ivec3 grid_size_ = glm::ivec3(0);
+
+		int cell_(float coordinate) const {
+			return int(std::floor(coordinate / voxel_size_));
+		}
+
+		bool occupied_(const glm::ivec3& voxel) {
+			voxels_tested++;
+			return is_occupied_((glm::vec3(voxel) + 0.5f) * voxel_size_);
+		}
+	};
+}
+
+#endif
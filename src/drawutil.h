@@ -11,6 +11,7 @@
 namespace drawUtils {
     std::vector<float> line_data{};
     unsigned int line_shader;
+    int depth_tex_location, resolution_location;
     glm::vec3 line_color(0., 0., 0.);
 
     unsigned int initLineShader() {
@@ -90,6 +91,9 @@ namespace drawUtils {
         glDeleteShader(vertex);
         glDeleteShader(fragment);
 
+        depth_tex_location = glGetUniformLocation(line_shader, "DepthTex");
+        resolution_location = glGetUniformLocation(line_shader, "Resolution");
+
         return line_shader;
     }
 
@@ -98,13 +102,13 @@ namespace drawUtils {
 
         glActiveTexture(GL_TEXTURE0 + slot);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(glGetUniformLocation(line_shader, "DepthTex"), slot);
+        glUniform1i(depth_tex_location, slot);
     }
 
     void passResolution(int width, int height) {
         glUseProgram(line_shader);
 
-        glUniform2i(glGetUniformLocation(line_shader, "Resolution"), width, height);
+        glUniform2i(resolution_location, width, height);
     }
 
     void drawLineDepth(glm::vec2 p1, glm::vec3 view1, glm::vec2 p2, glm::vec3 view2)
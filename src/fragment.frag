@@ -1,42 +1,132 @@
 #version 330 core
 
+#ifndef DEPTH_PREPASS
+#define DEPTH_PREPASS 0 // builds the coarse depth of the primary rays instead of path tracing
+#endif
+
+#if DEPTH_PREPASS
+layout (location = 0) out float FragCoarseDepth;
+#else
 layout (location = 0) out vec3 FragColor;
-layout (location = 1) out float FragHistory;
+layout (location = 1) out vec2 FragHistoryEmission;
 layout (location = 2) out float FragDepth;
 layout (location = 3) out vec3 FragAlbedo;
-layout (location = 4) out ivec3 FragNormal;
-layout (location = 5) out float FragEmission;
+layout (location = 4) out int FragNormal;
+layout (location = 5) out vec4 FragMoments;
+layout (location = 6) out uvec2 FragTraversal; // only stored when traversal stats are enabled
+#endif
 
 in vec2 TexCoord;
 uniform sampler2D LastFrameTex;
 uniform sampler2D HistoryTex;
 uniform sampler2D LastDepthTex;
 uniform isampler2D LastNormalTex;
+uniform sampler2D LastMomentsTex; // mipmapped, the top level holds the average sampling need (b) and geometry coverage (a) of the last frame
 
-uniform uvec2 Resolution;
-uniform uint FrameCount;
+uniform uvec2 Resolution; // size of the target of this pass
 
 uniform uvec3 MapSize;
 
-uniform mat4 CamRotation;
-uniform vec3 CamPosition;
-
-uniform mat4 LastCamRotation;
-uniform vec3 LastCamPosition;
+uniform usampler2D BrickMap; // the page pool when the map is paged
 
-uniform usampler2D BrickMap;
+// out-of-core map, see paging.h
+#define PAGE_SIZE 16
+uniform bool PagedMap;
+uniform usampler2D PageTable; // pool slot + 1 of every page, 0 if it isn't resident
+uniform int PoolColumns; // pages per row of the pool
 
 uniform usampler2DArray BricksTex;
 uniform usampler2D MatsTex;
+uniform usampler2D BrickLodTex; // LOD_RES^3 version of every brick, a row each
 
 uniform vec3 EnvironmentColor;
 
+// instanced models, see instances.h
+uniform isamplerBuffer InstancesTex; // top-level BVH nodes (2 texels each), then the instances (4 texels each), floats as int bits
+uniform usamplerBuffer ModelsTex; // brick grids of the models, packed like the brick map
+uniform int InstanceCount;
+uniform int InstanceBase; // texel of the first instance
+
+// procedural sky, see sky.h
+uniform sampler2D SkyLut; // sky radiance without the sun, equirectangular
+uniform vec3 SunDirection;
+uniform vec3 SunColor; // radiance at the center of the sun lobe
+uniform float SunExponent; // the sun is a pow(cos, SunExponent) lobe around SunDirection
+uniform bool SampleSun; // next event estimation of the sun, combined with the bounce directions by MIS
+
+uniform int BounceBudget; // bounces per path, at most MAX_BOUNCES
+uniform bool Progressive; // still camera and scene: unbiased running average over an unbounded history
+uniform bool AdaptiveSampling;
+uniform float SampleBudget; // average paths per pixel when sampling adaptively
+uniform int RouletteDepth; // bounces before Russian roulette may end a path, above the budget disables it
+uniform bool LightsEndPaths; // emissive materials end paths after their first bounce, biased but cheaper
+uniform int LodBounce; // bounces from which every brick is traced at LOD_RES, above MAX_BOUNCES disables it
+uniform float LodPixels; // primary rays trace the bricks whose LOD cells cover fewer pixels than this at LOD_RES, 0 disables it
+
+uniform sampler2D BlueNoiseTex; // two independent blue noise channels, tiled over the screen
+
+uniform bool PrimaryOnly; // only resolve the first hit, the lighting is traced in a separate lower resolution pass
+
+// primary ray acceleration
+uniform bool ReusePrimary; // camera and scene are unchanged, the last frame's depth and normal still hold
+uniform bool UseDepthPrepass;
+uniform sampler2D CoarseDepthTex; // distance every primary ray of a tile can skip, see CoarseDistance
+uniform usampler3D DilatedMapTex; // bricks occupied by themselves or a neighbour, padded by one brick on each side
+uniform int PrepassTile; // render pixels per coarse depth texel
+uniform float MaxSkip; // beyond this distance the rays of a tile can be more than a brick apart
+
+// per frame data shared by all passes, must match FrameData in main.cpp
+layout (std140) uniform FrameData {
+	mat4 CamRotation;
+	mat4 LastCamRotation;
+	vec3 CamPosition;
+	vec3 LastCamPosition;
+	uvec2 RenderResolution; // size of the full resolution targets, may be smaller than the window
+	uint FrameCount;
+	int UpscaleMode; // 0 - native, 1 - checkerboard (1/2 of the pixels per frame), 2 - interleaved (1/4)
+	int IndirectScale; // how many times lower the illumination resolution is
+	vec2 Jitter; // sub-pixel offset of this frame's primary rays, in screen coordinates
+	vec2 LastJitter;
+};
+
+// compile time options, the program cache injects overrides for each permutation (see ProgramCache)
+#ifndef BRICK_RES
 #define BRICK_RES 8
+#endif
+#ifndef LOD_RES
+#define LOD_RES 4 // cells along each side of a brick's coarse version
+#endif
+#ifndef MAP_CELL_BITS
+#define MAP_CELL_BITS 8 // per brick map cell, the models' cells take 4
+#endif
+#define MAP_CELLS_PER_WORD (32/MAP_CELL_BITS)
+#ifndef EPSILON
 #define EPSILON 0.00001
-#define SAMPLES 1.
-#define MAX_BOUNCES 3
+#endif
+#ifndef SAMPLES
+#define SAMPLES 1 // paths per traced pixel without adaptive sampling
+#endif
+#ifndef MAX_SAMPLES
+#define MAX_SAMPLES 4 // per pixel cap of adaptive sampling
+#endif
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 8 // cap of the bounce loop, BounceBudget picks the actual length at runtime
+#endif
+#ifndef SAMPLER
+#define SAMPLER 1 // 0 - white noise (PCG), 1 - spatiotemporal blue noise, 2 - Owen scrambled Sobol
+#endif
+#ifndef TRAVERSAL_STATS
+#define TRAVERSAL_STATS 0 // count DDA steps and rays into FragTraversal
+#endif
+#ifndef TLAS_STACK_SIZE
+#define TLAS_STACK_SIZE 24 // deeper top-level BVHs than this skip subtrees
+#endif
 
 uint ns;
+
+// traversal stats of this pixel's path
+uint traversalSteps = 0u;
+uint raysTraced = 0u;
 #define INIT_RNG ns = FrameCount*uint(Resolution.x*Resolution.y+529148401u) + uint((0.5*TexCoord.x+0.5)*Resolution.x+(0.5*TexCoord.y+0.5)*Resolution.x*Resolution.y)
 //#define INIT_RNG ns = 388269293u*FrameCount + 529148401u*uint((0.5*TexCoord.x+0.5)*Resolution.x) + 1720567137u*uint((0.5*TexCoord.y+0.5)*Resolution.y)
 
@@ -54,8 +144,77 @@ vec2 rand2(){return vec2(rand(), rand());}
 vec3 rand3(){return vec3(rand(), rand(), rand());}
 vec4 rand4(){return vec4(rand(), rand(), rand(), rand());}
 
+// Path samples: every call to Sample2D takes the next dimension of this pixel's sequence, so each bounce
+// gets its own well distributed sample while the frame count walks the sequence over time
+ivec2 samplePixel;
+uint sampleDimension = 0u;
+
+uint HashUint(uint x){
+	x ^= x >> 16; x *= 0x7feb352du;
+	x ^= x >> 15; x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+uint ReverseBits(uint x){ // bitfieldReverse needs GLSL 4.00
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// hash based Owen scrambling (Burley 2020, "Practical Hash-based Owen Scrambling")
+uint NestedUniformScramble(uint x, uint seed){
+	x = ReverseBits(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return ReverseBits(x);
+}
+
+// second Sobol dimension, the first one is the bit reversed index
+uint Sobol2(uint index){
+	uint result = 0u;
+	for (uint v = 1u << 31; index != 0u; index >>= 1, v ^= v >> 1)
+		if ((index & 1u) != 0u) result ^= v;
+	return result;
+}
+
+vec2 Sample2D(){
+	uint dimension = sampleDimension++;
+
+#if SAMPLER == 1
+	// the spatial pattern is shifted per dimension and rotated (Cranley-Patterson) by the R2 sequence per frame,
+	// which keeps every frame blue noise while the values at a pixel stay well distributed over time
+	ivec2 size = textureSize(BlueNoiseTex, 0);
+	vec2 noise = texelFetch(BlueNoiseTex, (samplePixel + ivec2(dimension*23u, dimension*41u)) % size, 0).rg;
+	uvec2 rotation = (FrameCount + dimension*0x9e3779b9u) * uvec2(3242174889u, 2447445414u); // R2 in 0.32 fixed point
+	return fract(noise + vec2(rotation >> 8) / 16777216.);
+#elif SAMPLER == 2
+	uint seed = HashUint(uint(samplePixel.x) ^ HashUint(uint(samplePixel.y) ^ HashUint(dimension)));
+	uint index = NestedUniformScramble(FrameCount, seed); // shuffled so pixels don't walk the sequence in lockstep
+	uint x = NestedUniformScramble(ReverseBits(index), HashUint(seed ^ 0xa511e9b3u));
+	uint y = NestedUniformScramble(Sobol2(index), HashUint(seed ^ 0x63d83595u));
+	return vec2(uvec2(x, y) >> 8) / 16777216.;
+#else
+	return rand2();
+#endif
+}
+
+// normals are stored packed as a single index, any ivec3 in [-1, 1] (including the no hit normal) round-trips
+int EncodeNormal(ivec3 n){
+	return (n.x+1) + (n.y+1)*3 + (n.z+1)*9;
+}
+
+ivec3 DecodeNormal(int code){
+	return ivec3(code%3, (code/3)%3, code/9) - ivec3(1);
+}
+
 vec3 CosWeightedRandomHemisphereDirection( const vec3 n ) {
-  vec2 r = rand2();
+  vec2 r = Sample2D();
 	vec3  uu = normalize( cross( n, vec3(0.0,1.0,1.0) ) );
 	vec3  vv = cross( uu, n );
 	float ra = sqrt(r.y);
@@ -76,10 +235,31 @@ struct Material{
 	vec3 color;
 	float roughness;
 	float emission;
+	int maxDepth; // paths end when they hit this material after this many bounces, 0 for no limit
 };
 
 uint GetBrickMapCell(ivec3 loc){
-	uint row = texelFetch(BrickMap, ivec2(loc.x*int(MapSize.y)/8 + loc.y/8, loc.z), 0).r;
+	if (PagedMap) {
+		uint page = texelFetch(PageTable, loc.xz/PAGE_SIZE, 0).r;
+		if (page == 0u) return 0u;
+
+		int slot = int(page) - 1;
+		loc.xz = loc.xz%PAGE_SIZE + ivec2(slot%PoolColumns, slot/PoolColumns)*PAGE_SIZE;
+	}
+
+	uint row = texelFetch(BrickMap, ivec2(loc.x*int(MapSize.y)/MAP_CELLS_PER_WORD + loc.y/MAP_CELLS_PER_WORD, loc.z), 0).r;
+	return (row >> (loc.y%MAP_CELLS_PER_WORD)*MAP_CELL_BITS) & ((1u << MAP_CELL_BITS) - 1u);
+}
+
+// a grid of bricks, the scene's brick map or an instanced model
+struct Grid{
+	int offset; // of the model in ModelsTex, -1 for the brick map
+	ivec3 size;
+};
+
+uint GetGridCell(Grid grid, ivec3 loc){
+	if (grid.offset < 0) return GetBrickMapCell(loc);
+	uint row = texelFetch(ModelsTex, grid.offset + (loc.z*grid.size.x + loc.x)*grid.size.y/8 + loc.y/8).r;
 	return (row >> (loc.y%8)*4) & 0xFu;
 }
 
@@ -88,21 +268,56 @@ uint GetBrickCell(int brick, ivec3 loc){
 	return (row >> (loc.y % 8)*4) & 0xFu;
 }
 
+// cell of the brick's coarse version, the most common material of the voxels it covers
+uint GetBrickLodCell(int brick, ivec3 loc){
+	int cell = (loc.z*LOD_RES + loc.x)*LOD_RES + loc.y;
+	uint row = texelFetch(BrickLodTex, ivec2(cell/8, brick-1), 0).r;
+	return (row >> (cell % 8)*4) & 0xFu;
+}
+
+uint GetBrickCell(int brick, ivec3 loc, bool lod){
+	return lod ? GetBrickLodCell(brick, loc) : GetBrickCell(brick, loc);
+}
+
 Material GetMaterial(int brickIndex, int matIndex){
 	uvec4 val = texelFetch(MatsTex, ivec2(matIndex, brickIndex), 0);
 	vec3 color = vec3(float((val.r >> 16) & 0xFFu)/255., float((val.r >> 8) & 0xFFu)/255., float((val.r >> 0) & 0xFFu)/255.);
 	float emission = (val.g & 0xFFFFu)/50.;
 	float roughness = float(val.r >> 24)/255.;
-	return Material(color, roughness, emission);
+	int maxDepth = int((val.g >> 16) & 0xFFu);
+	return Material(color, roughness, emission, maxDepth);
+}
+
+vec3 SkyRadiance(vec3 dir){
+	vec2 uv = vec2(atan(dir.z, dir.x)/6.2831853 + 0.5, acos(clamp(dir.y, -1., 1.))/3.1415927);
+	return textureLod(SkyLut, uv, 0.).rgb;
+}
+
+vec3 SunRadiance(vec3 dir){
+	return pow(max(dot(SunDirection, dir), 0.), SunExponent) * SunColor;
 }
 
 vec3 GetSky(vec3 dir){
 	if (EnvironmentColor != vec3(-1)) return EnvironmentColor;
-	
-	vec3 sky = clamp(exp2(-dir.y/vec3(.35,.45,.6)), 0., 1.);
-	vec3 sun = clamp(pow(dot(normalize(vec3(1., 2., 1.)), dir), 200), 0., 1.) * vec3(1., 0.8, 0.4) * 70.;
+	return SkyRadiance(dir) + SunRadiance(dir);
+}
+
+// density of SampleSunDirection, proportional to the sun lobe so every sun sample carries the same radiance/pdf
+float SunPdf(vec3 dir){
+	return (SunExponent + 1.)/6.2831853 * pow(max(dot(SunDirection, dir), 0.), SunExponent);
+}
+
+vec3 SampleSunDirection(vec2 r){
+	float cosTheta = pow(r.x, 1./(SunExponent + 1.));
+	float sinTheta = sqrt(max(1. - cosTheta*cosTheta, 0.));
 
-	return sky + sun;
+	vec3 uu = normalize(cross(SunDirection, abs(SunDirection.y) < 0.9 ? vec3(0., 1., 0.) : vec3(1., 0., 0.)));
+	vec3 vv = cross(SunDirection, uu);
+	return normalize(sinTheta*cos(6.2831853*r.y)*uu + sinTheta*sin(6.2831853*r.y)*vv + cosTheta*SunDirection);
+}
+
+float PowerHeuristic(float pdf, float otherPdf){
+	return pdf*pdf / (pdf*pdf + otherPdf*otherPdf);
 }
 
 vec4 TestBrick(int brick, vec2 coords){
@@ -131,14 +346,16 @@ SlabIntersection RaySlabIntersection(Ray ray, vec3 minpos, vec3 maxpos){
 struct GridHit{
 	bool hit;
 	float dist;
-	ivec3 normal;
+	vec3 normal; // axis aligned, unless the hit is on a rotated instance
 	Material mat;
 	int additional;
 };
 
 // J. Amanatides, A. Woo. A Fast Voxel Traversal Algorithm for Ray Tracing.
-GridHit RayBrickIntersection(Ray ray, int brickIndex, vec3 gridPos, float gridScale){
-	GridHit noHit = GridHit(false, -1., ivec3(-1), Material(vec3(0.), 0., 0.), 0);
+// bricks entered from lodDistance on are traced at LOD_RES. the brick the ray starts in, and those it enters within a
+// brick of its origin, keep full detail: a coarse cell there could cover the surface the ray leaves
+GridHit RayBrickIntersection(Ray ray, int brickIndex, vec3 gridPos, float gridScale, float lodDistance){
+	GridHit noHit = GridHit(false, -1., vec3(-1.), Material(vec3(0.), 0., 0., 0), 0);
 
 	SlabIntersection boundHit = RaySlabIntersection(ray, gridPos, gridPos + vec3(gridScale));
 	if (!boundHit.hit) return noHit;
@@ -150,10 +367,12 @@ GridHit RayBrickIntersection(Ray ray, int brickIndex, vec3 gridPos, float gridSc
 	if (tMin < 0.) ray_start = ray.origin - gridPos;
 	vec3 ray_end = ray.origin + ray.dir * tMax - gridPos;
 
-	float voxel_size = gridScale/BRICK_RES;
+	bool lod = tMin >= max(lodDistance, gridScale);
+	int res = lod ? LOD_RES : BRICK_RES;
+	float voxel_size = gridScale/res;
 
-	ivec3 curr_voxel = max(min(ivec3((ray_start)/voxel_size), ivec3(BRICK_RES-1)), ivec3(0));
-	ivec3 last_voxel = max(min(ivec3((ray_end)/voxel_size), ivec3(BRICK_RES-1)), ivec3(0));
+	ivec3 curr_voxel = max(min(ivec3((ray_start)/voxel_size), ivec3(res-1)), ivec3(0));
+	ivec3 last_voxel = max(min(ivec3((ray_end)/voxel_size), ivec3(res-1)), ivec3(0));
 
 	ivec3 step = ivec3(sign(ray.dir));
 
@@ -164,10 +383,10 @@ GridHit RayBrickIntersection(Ray ray, int brickIndex, vec3 gridPos, float gridSc
 	bvec3 mask = boundHit.normal;
 
 	int iter = 0;
-	while(last_voxel != curr_voxel && iter++ < BRICK_RES*4) {
-		uint cell = GetBrickCell(brickIndex, curr_voxel);
+	while(last_voxel != curr_voxel && iter++ < res*4) {
+		uint cell = GetBrickCell(brickIndex, curr_voxel, lod);
 		if (cell != 0u)
-			return GridHit(true, dist + max(tMin, 0.), -ivec3(mask)*step, GetMaterial(brickIndex-1, int(cell)), iter);
+			return GridHit(true, dist + max(tMin, 0.), vec3(-ivec3(mask)*step), GetMaterial(brickIndex-1, int(cell)), iter);
 
 		mask = lessThanEqual(t_next.xyz, min(t_next.yzx, t_next.zxy));
 
@@ -176,18 +395,18 @@ GridHit RayBrickIntersection(Ray ray, int brickIndex, vec3 gridPos, float gridSc
 		curr_voxel += ivec3(mask) * step;
 	}
 
-	uint cell = GetBrickCell(brickIndex, curr_voxel);
+	uint cell = GetBrickCell(brickIndex, curr_voxel, lod);
 	if (cell != 0u)
-		return GridHit(true, dist + max(tMin, 0.), -ivec3(mask)*step, GetMaterial(brickIndex-1, int(cell)), iter);
+		return GridHit(true, dist + max(tMin, 0.), vec3(-ivec3(mask)*step), GetMaterial(brickIndex-1, int(cell)), iter);
 	
 	noHit.additional = iter;
 	return noHit;
 }
 
-GridHit RaySceneIntersection(Ray ray, vec3 gridPos, float gridScale, int limit){
-	GridHit noHit = GridHit(false, -1., ivec3(-1), Material(vec3(0.), 0., 0.), 0);
+GridHit RayGridIntersection(Ray ray, Grid grid, vec3 gridPos, float gridScale, int limit, float lodDistance){
+	GridHit noHit = GridHit(false, -1., vec3(-1.), Material(vec3(0.), 0., 0., 0), 0);
 
-	SlabIntersection boundHit = RaySlabIntersection(ray, gridPos, gridPos + MapSize*gridScale);
+	SlabIntersection boundHit = RaySlabIntersection(ray, gridPos, gridPos + vec3(grid.size)*gridScale);
 	if (!boundHit.hit) return noHit;
 
 	float tMin = boundHit.tmin;
@@ -199,8 +418,8 @@ GridHit RaySceneIntersection(Ray ray, vec3 gridPos, float gridScale, int limit){
 
 	float voxel_size = gridScale;
 
-	ivec3 curr_voxel = max(min(ivec3((ray_start)/voxel_size), ivec3(MapSize)-ivec3(1)), ivec3(0));
-	ivec3 last_voxel = max(min(ivec3((ray_end)/voxel_size), ivec3(MapSize)-ivec3(1)), ivec3(0));
+	ivec3 curr_voxel = max(min(ivec3((ray_start)/voxel_size), grid.size-ivec3(1)), ivec3(0));
+	ivec3 last_voxel = max(min(ivec3((ray_end)/voxel_size), grid.size-ivec3(1)), ivec3(0));
 
 	ivec3 step = ivec3(sign(ray.dir));
 
@@ -211,9 +430,9 @@ GridHit RaySceneIntersection(Ray ray, vec3 gridPos, float gridScale, int limit){
 
 	int iter = 0, brickIter = 0;
 	while(last_voxel != curr_voxel && iter++ < limit) {
-		uint cell = GetBrickMapCell(curr_voxel);
+		uint cell = GetGridCell(grid, curr_voxel);
 		if (cell != 0u){
-			GridHit hit = RayBrickIntersection(ray, int(cell), gridPos + curr_voxel*gridScale, gridScale);
+			GridHit hit = RayBrickIntersection(ray, int(cell), gridPos + curr_voxel*gridScale, gridScale, lodDistance);
 			brickIter += hit.additional;
 			if (hit.hit) return GridHit(true, hit.dist, hit.normal, hit.mat, iter + brickIter);
 		}
@@ -224,9 +443,9 @@ GridHit RaySceneIntersection(Ray ray, vec3 gridPos, float gridScale, int limit){
 		curr_voxel += ivec3(mask) * step;
 	}
 
-	uint cell = GetBrickMapCell(curr_voxel);
+	uint cell = GetGridCell(grid, curr_voxel);
 	if (cell != 0u){
-		GridHit hit = RayBrickIntersection(ray, int(cell), gridPos + curr_voxel*gridScale, gridScale);
+		GridHit hit = RayBrickIntersection(ray, int(cell), gridPos + curr_voxel*gridScale, gridScale, lodDistance);
 		brickIter += hit.additional;
 		if (hit.hit) return GridHit(true, hit.dist, hit.normal, hit.mat, iter + brickIter);
 	}
@@ -236,20 +455,220 @@ GridHit RaySceneIntersection(Ray ray, vec3 gridPos, float gridScale, int limit){
 	return noHit;
 }
 
+// the ray is moved into the instance's model space without normalizing the direction, so distances along it
+// stay world distances
+GridHit RayInstanceIntersection(Ray ray, int instance, float lodDistance){
+	int base = InstanceBase + instance*4;
+	vec4 row0 = intBitsToFloat(texelFetch(InstancesTex, base));
+	vec4 row1 = intBitsToFloat(texelFetch(InstancesTex, base + 1));
+	vec4 row2 = intBitsToFloat(texelFetch(InstancesTex, base + 2));
+	ivec4 model = texelFetch(InstancesTex, base + 3);
+
+	vec3 origin = vec3(dot(row0.xyz, ray.origin) + row0.w, dot(row1.xyz, ray.origin) + row1.w, dot(row2.xyz, ray.origin) + row2.w);
+	vec3 dir = vec3(dot(row0.xyz, ray.dir), dot(row1.xyz, ray.dir), dot(row2.xyz, ray.dir));
+
+	Grid grid = Grid(model.x, model.yzw);
+	GridHit hit = RayGridIntersection(Ray(origin, dir, 1.0/dir), grid, vec3(0.), 1., grid.size.x + grid.size.y + grid.size.z, lodDistance);
+
+	// normals go back by the transpose of the world to model matrix
+	if (hit.hit) hit.normal = normalize(row0.xyz*hit.normal.x + row1.xyz*hit.normal.y + row2.xyz*hit.normal.z);
+	return hit;
+}
+
+// entry distance of a top-level node, negative when the ray misses it or enters it beyond maxDist
+float NodeEntry(Ray ray, int node, float maxDist){
+	SlabIntersection bound = RaySlabIntersection(ray, intBitsToFloat(texelFetch(InstancesTex, node*2).xyz), intBitsToFloat(texelFetch(InstancesTex, node*2 + 1).xyz));
+	if (!bound.hit || bound.tmin >= maxDist) return -1.;
+	return max(bound.tmin, 0.);
+}
+
+// closest instance hit before maxDist, the top-level BVH is walked nearest child first
+GridHit RayInstancesIntersection(Ray ray, float maxDist, float lodDistance){
+	GridHit closest = GridHit(false, -1., vec3(-1.), Material(vec3(0.), 0., 0., 0), 0);
+	if (InstanceCount == 0 || NodeEntry(ray, 0, maxDist) < 0.) return closest;
+
+	int steps = 0;
+	int stack[TLAS_STACK_SIZE];
+	int stackSize = 0;
+	int node = 0;
+
+	while (true){
+		int first = texelFetch(InstancesTex, node*2).w;
+		int count = texelFetch(InstancesTex, node*2 + 1).w;
+
+		if (count > 0){
+			for (int i = first; i < first + count; i++){
+				GridHit hit = RayInstanceIntersection(ray, i, lodDistance);
+				steps += hit.additional;
+				if (hit.hit && hit.dist < maxDist){
+					closest = hit;
+					maxDist = hit.dist;
+				}
+			}
+
+			if (stackSize == 0) break;
+			node = stack[--stackSize];
+			continue;
+		}
+
+		float leftEntry = NodeEntry(ray, first, maxDist);
+		float rightEntry = NodeEntry(ray, first + 1, maxDist);
+
+		if (leftEntry < 0. && rightEntry < 0.){
+			if (stackSize == 0) break;
+			node = stack[--stackSize];
+		}
+		else if (rightEntry < 0.) node = first;
+		else if (leftEntry < 0.) node = first + 1;
+		else {
+			bool leftFirst = leftEntry <= rightEntry;
+			if (stackSize < TLAS_STACK_SIZE) stack[stackSize++] = leftFirst ? first + 1 : first;
+			node = leftFirst ? first : first + 1;
+		}
+	}
+
+	closest.additional = steps;
+	return closest;
+}
+
+// an instance in front of the brick map's hit replaces it. a map ray that ran out of steps keeps its
+// result unless an instance is hit
+GridHit WithInstances(Ray ray, GridHit mapHit, float lodDistance){
+	if (InstanceCount == 0) return mapHit;
+
+	GridHit hit = RayInstancesIntersection(ray, mapHit.hit ? mapHit.dist : 1e30, lodDistance);
+	if (!hit.hit){
+		mapHit.additional += hit.additional;
+		return mapHit;
+	}
+
+	hit.additional += mapHit.additional;
+	return hit;
+}
+
+GridHit RaySceneIntersection(Ray ray, int limit, float lodDistance){
+	GridHit hit = RayGridIntersection(ray, Grid(-1, ivec3(MapSize)), vec3(0.), 1., limit, lodDistance);
+	return WithInstances(ray, hit, lodDistance);
+}
+
+// distance from which a brick's LOD cells cover fewer than LodPixels pixels, a pixel's footprint grows by
+// 2/(1.5*height) per unit of distance
+float PrimaryLodDistance(){
+	if (LodPixels <= 0.) return 1e30;
+	return 1.5*float(RenderResolution.y)/(2.*float(LOD_RES)*LodPixels);
+}
+
+// first hit of a still pixel from the last frame's depth and normal, only the material is looked up again.
+// fails (and the ray is traced) when the voxel moved under the pixel, e.g. from R16F depth rounding
+bool ReusePrimaryHit(Ray ray, out GridHit hit){
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float dist = texelFetch(LastDepthTex, pixel, 0).r;
+	ivec3 normal = DecodeNormal(texelFetch(LastNormalTex, pixel, 0).r);
+
+	hit = GridHit(false, -1., vec3(-1.), Material(vec3(0.), 0., 0., 0), 0);
+	if (dist < 0.) return true; // sky
+	if (dist == 0. || normal == ivec3(-1)) return false;
+
+	vec3 voxelPos = ray.origin + ray.dir*dist - vec3(normal)*(0.5/BRICK_RES);
+	ivec3 brickPos = ivec3(floor(voxelPos));
+	if (any(lessThan(brickPos, ivec3(0))) || any(greaterThanEqual(brickPos, ivec3(MapSize)))) return false;
+
+	uint brick = GetBrickMapCell(brickPos);
+	if (brick == 0u) return false;
+
+	// the same detail the brick was traced with
+	bool lod = RaySlabIntersection(ray, vec3(brickPos), vec3(brickPos + 1)).tmin >= max(PrimaryLodDistance(), 1.);
+	int res = lod ? LOD_RES : BRICK_RES;
+	uint cell = GetBrickCell(int(brick), min(ivec3(fract(voxelPos)*res), ivec3(res-1)), lod);
+	if (cell == 0u) return false;
+
+	hit = GridHit(true, dist, vec3(normal), GetMaterial(int(brick)-1, int(cell)), 0);
+	return true;
+}
+
+// Distance the primary rays of a tile can travel without passing a brick. The tile's center ray is walked through the
+// dilated brick map: every ray of the tile stays within a brick of it up to MaxSkip, so while the center ray only passes
+// cells with no occupied neighbour, the other rays can't have reached an occupied brick either
+float CoarseDistance(Ray ray){
+	vec3 gridMin = vec3(-1.);
+	ivec3 size = ivec3(MapSize) + ivec3(2);
+
+	SlabIntersection bound = RaySlabIntersection(ray, gridMin, gridMin + vec3(size));
+	if (!bound.hit) return MaxSkip;
+
+	float t = max(bound.tmin, 0.);
+	vec3 start = ray.origin + ray.dir*t - gridMin;
+
+	ivec3 cell = clamp(ivec3(floor(start)), ivec3(0), size - ivec3(1));
+	ivec3 step = ivec3(sign(ray.dir));
+
+	vec3 tNext = t + (vec3(cell + max(step, ivec3(0))) - start)*ray.inverse_dir;
+	vec3 tDelta = abs(ray.inverse_dir);
+
+	int limit = size.x + size.y + size.z;
+	for (int i = 0; i < limit; i++){
+		if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, size))) return MaxSkip; // left the map
+		if (texelFetch(DilatedMapTex, cell, 0).r != 0u) return min(t, MaxSkip);
+
+		bvec3 mask = lessThanEqual(tNext.xyz, min(tNext.yzx, tNext.zxy));
+		t = min(min(tNext.x, tNext.y), tNext.z);
+		tNext += vec3(mask) * tDelta;
+		cell += ivec3(mask) * step;
+	}
+
+	return min(t, MaxSkip);
+}
+
+GridHit TracePrimary(Ray ray){
+	GridHit hit;
+	if (ReusePrimary && ReusePrimaryHit(ray, hit)) return hit;
+
+	float skip = 0.;
+	if (UseDepthPrepass){
+		ivec2 tile = ivec2((TexCoord*0.5+0.5)*vec2(RenderResolution)) / PrepassTile;
+		skip = max(texelFetch(CoarseDepthTex, tile, 0).r, 0.);
+	}
+
+	// the coarse depth only knows the brick map, the instances are traced from the camera
+	Ray skipped = Ray(ray.origin + ray.dir*skip, ray.dir, ray.inverse_dir);
+	// the skipped ray's distances are shorter by skip, its bricks are traced coarse from the same distance
+	float lodDistance = PrimaryLodDistance();
+	hit = RayGridIntersection(skipped, Grid(-1, ivec3(MapSize)), vec3(0.), 1., int(MapSize.x + MapSize.y + MapSize.z), lodDistance - skip);
+	if (hit.hit) hit.dist += skip;
+	return WithInstances(ray, hit, lodDistance);
+}
+
 vec3 Trace(Ray ray, GridHit firstHit){
 	vec3 rayColor = vec3(1.);
 	vec3 incomingLight = vec3(0.);
 
+	// cosine pdf of the last bounce direction when the sun was also sampled there, negative otherwise
+	float bouncePdf = -1.;
+
+	// bounce rays are at least as wide as the primary ones, from LodBounce on every brick they pass is traced coarse
+	float primaryLod = PrimaryLodDistance();
+
 	int limit = int(MapSize.x + MapSize.y + MapSize.z);
 	for (int i=0; i <= MAX_BOUNCES; i++){
+		if (i > BounceBudget) break;
+
 		GridHit hitInfo;
 		if (i == 0) hitInfo = firstHit;
-		else hitInfo = RaySceneIntersection(ray, vec3(0.), 1., limit);
+		else {
+			hitInfo = RaySceneIntersection(ray, limit, i >= LodBounce ? 0. : primaryLod);
+#if TRAVERSAL_STATS
+			traversalSteps += uint(hitInfo.additional);
+			raysTraced++;
+#endif
+		}
 
 		if (!hitInfo.hit){
-			if (hitInfo.dist < 0.)
-				return incomingLight + rayColor * GetSky(ray.dir);
-			return vec3(0.);
+			if (hitInfo.dist >= 0.) return vec3(0.);
+
+			// the sun was sampled explicitly at the last bounce, only this strategy's share of it is added here
+			if (bouncePdf >= 0.)
+				return incomingLight + rayColor * (SkyRadiance(ray.dir) + SunRadiance(ray.dir) * PowerHeuristic(bouncePdf, SunPdf(ray.dir)));
+			return incomingLight + rayColor * GetSky(ray.dir);
 		}
 
 		if (i != 0) {
@@ -257,8 +676,39 @@ vec3 Trace(Ray ray, GridHit firstHit){
 			incomingLight += rayColor * hitInfo.mat.emission;
 		}
 
+		int maxDepth = LightsEndPaths && hitInfo.mat.emission > 0. ? 1 : hitInfo.mat.maxDepth;
+		if (maxDepth > 0 && i >= maxDepth) break;
+
+		// Russian roulette on the path throughput, survivors are reweighted by 1/p so the estimate stays unbiased
+		if (i >= RouletteDepth) {
+			float survival = min(max(rayColor.r, max(rayColor.g, rayColor.b)), 0.95);
+			if (rand() >= survival) break;
+			rayColor /= survival;
+		}
+
 		ray.origin += ray.dir*hitInfo.dist + hitInfo.normal*EPSILON;
-		
+
+		// only lambertian surfaces have a bounce pdf to weigh against, and only bounces that are traced further
+		// may take light from the sun, otherwise the path length would depend on the strategy
+		bool sampleSun = SampleSun && hitInfo.mat.roughness >= 1. && i < min(BounceBudget, MAX_BOUNCES);
+		if (sampleSun) {
+			vec3 sunDir = SampleSunDirection(Sample2D());
+			float cosine = dot(sunDir, vec3(hitInfo.normal));
+
+			if (cosine > 0.) {
+				// the sun ray leaves the same vertex as the next bounce ray, and takes the same detail
+				GridHit shadow = RaySceneIntersection(Ray(ray.origin, sunDir, 1.0/sunDir), limit, i + 1 >= LodBounce ? 0. : primaryLod);
+#if TRAVERSAL_STATS
+				traversalSteps += uint(shadow.additional);
+				raysTraced++;
+#endif
+				if (!shadow.hit && shadow.dist < 0.) {
+					float sunPdf = SunPdf(sunDir);
+					incomingLight += rayColor * SunRadiance(sunDir) * (cosine/3.1415927) / sunPdf * PowerHeuristic(sunPdf, cosine/3.1415927);
+				}
+			}
+		}
+
 		vec3 diffuseDir = CosWeightedRandomHemisphereDirection(hitInfo.normal);
 
 		vec3 specularDir = reflect(ray.dir, vec3(hitInfo.normal));
@@ -266,12 +716,21 @@ vec3 Trace(Ray ray, GridHit firstHit){
 		ray.dir = normalize(mix(specularDir, diffuseDir, hitInfo.mat.roughness));
 		ray.inverse_dir = 1.0/ray.dir;
 
+		bouncePdf = sampleSun ? max(dot(ray.dir, vec3(hitInfo.normal)), 0.)/3.1415927 : -1.;
+
 		limit = int(pow(limit, max(0.87, 1./(i+1))));
 	}
 
 	return incomingLight;
 }
 
+// temporal upscaling: which pixels trace new paths this frame, every pixel is covered every 2 or 4 frames
+bool IsTracedPixel(ivec2 pixel){
+	if (UpscaleMode == 1) return ((pixel.x + pixel.y + int(FrameCount)) & 1) == 0;
+	if (UpscaleMode == 2) return ((pixel.x & 1) + (pixel.y & 1)*2) == int(FrameCount % 4u);
+	return true;
+}
+
 float RaySphereIntersection(Ray ray, vec3 pos, float radius) {
 	vec3 origin = ray.origin - pos;
 
@@ -286,13 +745,14 @@ float RaySphereIntersection(Ray ray, vec3 pos, float radius) {
 	return (-b - sqrt(discriminant))/(2*a);
 }
 
+// where the last frame traced p, its rays were offset by LastJitter
 vec2 WorldToLastScreenCoord(vec3 p){
 	vec3 dir = normalize(p - LastCamPosition);
 
 	vec3 localNearPlane = (transpose(LastCamRotation) * vec4(dir, 0.)).xyz;
 	vec2 texCoord = (localNearPlane.xy/localNearPlane.z*1.5)/vec2(float(Resolution.x)/float(Resolution.y), 1.);
 
-	return texCoord;
+	return texCoord - LastJitter;
 }
 
 uniform vec3[] offsets = vec3[](
@@ -331,14 +791,16 @@ struct SamplePoint{
 	float history;
 	vec3 color;
 	float accuracy;
+	vec2 moments;
 };
 
 SamplePoint FindBestSample(GridHit hit, Ray ray){
-	if (!hit.hit) return SamplePoint(100., 0., vec3(0.), 0.);
+	if (!hit.hit) return SamplePoint(100., 0., vec3(0.), 0., vec2(0.));
 
 	vec3 hitPos = CamPosition + hit.dist * ray.dir;
 
-	vec3 normalPlane = vec3(1.) - abs(hit.normal);
+	ivec3 hitNormal = ivec3(round(hit.normal)); // as stored in the normal target
+	vec3 normalPlane = vec3(1.) - abs(vec3(hitNormal));
 
 	float bestDist = 100.;
 	vec2 bestCoord = vec2(0.);
@@ -354,9 +816,9 @@ SamplePoint FindBestSample(GridHit hit, Ray ray){
 
 		vec3 actualPos = LastCamPosition + normalize(currPos - LastCamPosition) * texture(LastDepthTex, currCoord, 0).r;
 		float dist = distance(hitPos, actualPos);
-		ivec3 normal = texture(LastNormalTex, currCoord, 0).rgb;
+		ivec3 normal = DecodeNormal(texture(LastNormalTex, currCoord, 0).r);
 
-		if (normal == hit.normal){
+		if (normal == hitNormal){
 			if (dist < bestDist) {
 				bestDist = dist;
 				bestCoord = currCoord;
@@ -377,14 +839,46 @@ SamplePoint FindBestSample(GridHit hit, Ray ray){
 
 	if (bestDist > 0.1) accuracy = 0.;
 
-	float history = texelFetch(HistoryTex, ivec2(bestCoord*Resolution), 0).r;
+	// the last frame may have been rendered at a different resolution
+	float history = texelFetch(HistoryTex, ivec2(bestCoord*textureSize(HistoryTex, 0)), 0).r;
 
 	float weight = mix(0.85, 1., min(history/200., 1.));
 	if (hit.mat.roughness < 1.) weight = mix(weight, 1., 0.97);
+	if (Progressive) weight = 1.;
+
+	// a still camera finds the same pixel at a jittered position every frame, filtering it would blur the
+	// accumulation a little more every frame
+	vec3 lastColor = texture(LastFrameTex, bestCoord).rgb;
+	vec2 moments = textureLod(LastMomentsTex, bestCoord, 0.).rg;
+	if (Progressive) {
+		ivec2 lastPixel = ivec2(bestCoord*textureSize(LastFrameTex, 0));
+		lastColor = texelFetch(LastFrameTex, lastPixel, 0).rgb;
+		moments = texelFetch(LastMomentsTex, lastPixel, 0).rg;
+	}
+
+	return SamplePoint(bestDist, history, mix(colorSum/max(matchCount, 1.), lastColor, weight), accuracy, moments);
+}
 
-	return SamplePoint(bestDist, history, mix(colorSum/max(matchCount, 1.), texture(LastFrameTex, bestCoord).rgb, weight), accuracy);
+// how much a pixel needs new paths: its relative standard deviation over the error already averaged away,
+// so noisy and freshly disoccluded pixels get more paths than converged ones
+float SampleNeed(vec2 moments, float history){
+	float variance = max(moments.y - moments.x*moments.x, 0.);
+	return (sqrt(variance)/(moments.x + 0.05) + 0.05) / sqrt(history + 1.);
 }
 
+#if DEPTH_PREPASS
+void main()
+{
+	// center ray of this texel's tile
+	vec2 centerPixel = gl_FragCoord.xy * float(PrepassTile);
+	vec2 coord = centerPixel/vec2(RenderResolution)*2. - 1.;
+
+	float aspect = float(RenderResolution.x)/float(RenderResolution.y);
+	vec3 dir = normalize((CamRotation * vec4(coord.x*aspect, coord.y, 1.5, 0.)).xyz);
+
+	FragCoarseDepth = CoarseDistance(Ray(CamPosition, dir, 1.0/dir));
+}
+#else
 void main()
 {
 	// if (TexCoord.y > 0.98){
@@ -394,48 +888,98 @@ void main()
 	// }
 
 	INIT_RNG;
+	samplePixel = ivec2(gl_FragCoord.xy);
 
 	float aspect = float(Resolution.x)/float(Resolution.y);
 
-	vec3 localNearPlane = vec3(TexCoord.x*aspect, TexCoord.y, 1.5);
+	vec2 screenPos = TexCoord + Jitter; // supersampled over time by the temporal anti-aliasing
+	vec3 localNearPlane = vec3(screenPos.x*aspect, screenPos.y, 1.5);
 
 	vec3 firstDir = normalize((CamRotation * vec4(localNearPlane, 0.)).xyz);
 	Ray firstRay = Ray(CamPosition, firstDir, 1.0/firstDir);
-	GridHit firstHit = RaySceneIntersection(firstRay, vec3(0.), 1., int(MapSize.x + MapSize.y + MapSize.z));
+	GridHit firstHit = TracePrimary(firstRay);
 
 	FragDepth = firstHit.dist;
-	FragNormal = firstHit.normal;
+	FragNormal = EncodeNormal(ivec3(round(firstHit.normal)));
+
+#if TRAVERSAL_STATS
+	traversalSteps = uint(firstHit.additional);
+	raysTraced = 1u;
+	FragTraversal = uvec2(traversalSteps, raysTraced);
+#endif
 
 	if (!firstHit.hit){
+		FragColor = vec3(0.);
 		FragAlbedo = GetSky(firstDir);
-		FragEmission = -1.;
+		FragHistoryEmission.y = -1.;
+		FragMoments = vec4(0.);
 		return;
 	}
 
-	vec3 sumColor = vec3(0.);
-	for (int s = 0; s < SAMPLES; s++) {
-		vec3 offset =  vec3(2.*rand2()-1., 0.)/Resolution.y; // for anti aliasing
+	if (firstHit.hit) FragAlbedo = firstHit.mat.color;
+	else FragAlbedo = vec3(1.);
 
-		sumColor += Trace(firstRay, firstHit);
+	if (PrimaryOnly){
+		FragHistoryEmission = vec2(0., firstHit.mat.emission);
+		return;
 	}
 
-	vec3 color = sumColor/SAMPLES;
-
 	// spatiotemporal denoisification
 	SamplePoint sample = FindBestSample(firstHit, firstRay);
 
 	float historyScale = (1. - sample.dist*1.5) * sample.accuracy;
 	if (LastCamPosition != CamPosition) historyScale *= pow(firstHit.mat.roughness, 0.12);
 
-	FragHistory = sample.history * historyScale + 1.;
+	float history = sample.history * historyScale;
 
-	if (LastCamPosition != CamPosition) FragHistory = min(FragHistory, 1. + firstHit.mat.roughness * 200.);
+	if (LastCamPosition != CamPosition) history = min(history, firstHit.mat.roughness * 200.);
 
-	if (firstHit.hit) FragAlbedo = firstHit.mat.color;
-	else FragAlbedo = vec3(1.);
+	float need = SampleNeed(sample.moments, history);
 
-	FragEmission = firstHit.mat.emission;
+	// pixels outside this frame's subset keep their reprojected result, unless it has no usable history
+	bool traced = IsTracedPixel(ivec2(gl_FragCoord.xy)) || history < 1.;
 
-	FragColor = mix(sample.color, color, 1.0/(pow(FragHistory, 0.97)));
+	// adaptive sampling splits the frame's path budget by need, relative to the last frame's average over the
+	// pixels that hit geometry (the top level's b over its coverage a, the sky has neither). the traced subset is
+	// spread evenly over the screen, so the mean holds for it too. the fraction is rounded stochastically so the
+	// budget holds on average, converged pixels may get no path at all
+	int samples = SAMPLES;
+	if (AdaptiveSampling && traced) {
+		vec4 meanMoments = textureLod(LastMomentsTex, vec2(0.5), 20.);
+		float meanNeed = meanMoments.a > 0. ? meanMoments.b / meanMoments.a : 0.;
+		float wanted = meanNeed > 0. ? SampleBudget * need / meanNeed : SampleBudget;
+		samples = clamp(int(wanted + rand()), history < 1. ? 1 : 0, MAX_SAMPLES);
+	}
+
+	if (!traced || samples == 0){
+		FragHistoryEmission = vec2(history, firstHit.mat.emission);
+		FragColor = sample.color;
+		FragMoments = vec4(sample.moments, need, 1.);
+		return;
+	}
+
+	history += 1.;
+
+	vec3 sumColor = vec3(0.);
+	for (int s = 0; s < max(SAMPLES, MAX_SAMPLES); s++) {
+		if (s >= samples) break;
+		sumColor += Trace(firstRay, firstHit);
+	}
+
+	vec3 color = sumColor/float(samples);
+
+#if TRAVERSAL_STATS
+	FragTraversal = uvec2(traversalSteps, raysTraced);
+#endif
+
+	FragHistoryEmission = vec2(history, firstHit.mat.emission);
+
+	float blend = Progressive ? 1.0/history : 1.0/(pow(history, 0.97));
+	float luminance = dot(color, vec3(0.2126, 0.7152, 0.0722));
+	vec2 moments = mix(sample.moments, vec2(luminance, luminance*luminance), blend);
+	FragMoments = vec4(moments, SampleNeed(moments, history), 1.);
+
+	FragColor = mix(sample.color, color, blend);
 	return;
-}
\ No newline at end of file
+}
+#endif
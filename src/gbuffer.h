@@ -0,0 +1,237 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <initializer_list>
+
+enum BufferTexture {
+	SCREEN_TEXTURE = 0,
+	HISTORY_EMISSION_TEXTURE,
+	DEPTH_TEXTURE,
+	ALBEDO_TEXTURE,
+	NORMAL_TEXTURE,
+	MOMENTS_TEXTURE,
+	TRAVERSAL_TEXTURE, // optional, only allocated when traversal stats are enabled
+	BUFFER_TEXTURE_COUNT
+};
+
+// g-buffer textures are bound to texture units starting here, the units before it hold the scene textures
+const unsigned int kBufferTextureSlot = 5;
+
+namespace gbuffer {
+	struct TargetFormat {
+		GLint internal_format;
+		GLenum format;
+		GLenum type;
+		unsigned int bytes_per_pixel;
+	};
+
+	// selectable precision for the targets where it is a quality/bandwidth tradeoff. the radiance target holds the
+	// running average of up to 2048 frames, R11G11B10F's 6 and 5 bit mantissas can't step by 1/history and would
+	// stall it, so it isn't offered there (see kFrameColorFormat)
+	enum RadianceFormat {
+		RADIANCE_RGBA16F = 0,
+		RADIANCE_RGB32F,
+	};
+
+	enum DepthFormat {
+		DEPTH_R32F = 0,
+		DEPTH_R16F,
+	};
+
+	const char* kRadianceFormatNames[] = { "RGBA16F", "RGB32F" };
+	const char* kDepthFormatNames[] = { "R32F", "R16F" };
+
+	const TargetFormat kRadianceFormats[] = {
+		{ GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8 },
+		{ GL_RGB32F, GL_RGB, GL_FLOAT, 12 },
+	};
+
+	// R16F only has 11 bits of mantissa, so it is only usable for small maps where
+	// the depth step stays well below the reprojection tolerance
+	const TargetFormat kDepthFormats[] = {
+		{ GL_R32F, GL_RED, GL_FLOAT, 4 },
+		{ GL_R16F, GL_RED, GL_HALF_FLOAT, 2 },
+	};
+
+	// color of a single frame that is read and never accumulated into, e.g. the input of the temporal AA
+	const TargetFormat kFrameColorFormat = { GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, 4 };
+
+	// history count (r) and emission (g), -1 emission marks a sky pixel
+	const TargetFormat kHistoryEmissionFormat = { GL_RG16F, GL_RG, GL_HALF_FLOAT, 4 };
+	const TargetFormat kAlbedoFormat = { GL_RGB8, GL_RGB, GL_UNSIGNED_BYTE, 3 };
+	// voxel normals are axis aligned, so they are packed into a single index (see EncodeNormal in the shaders)
+	const TargetFormat kNormalFormat = { GL_R8I, GL_RED_INTEGER, GL_BYTE, 1 };
+	// luminance mean (r) and mean square (g) accumulated with the radiance, the adaptive sampling need (b) and 1 (a)
+	// where the first hit is geometry. mipmapped after the trace pass, the top level's b over its a is the frame's
+	// average need
+	const TargetFormat kMomentsFormat = { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8 };
+	// DDA steps (r) and rays traced (g) for the pixel's whole path
+	const TargetFormat kTraversalFormat = { GL_RG32UI, GL_RG_INTEGER, GL_UNSIGNED_INT, 8 };
+
+	struct Layout {
+		int radiance = RADIANCE_RGBA16F;
+		int depth = DEPTH_R32F;
+		bool traversal_stats = false;
+
+		unsigned int bytesPerPixel() const {
+			return kRadianceFormats[radiance].bytes_per_pixel + kDepthFormats[depth].bytes_per_pixel
+				+ kHistoryEmissionFormat.bytes_per_pixel + kAlbedoFormat.bytes_per_pixel + kNormalFormat.bytes_per_pixel
+				+ kMomentsFormat.bytes_per_pixel + (traversal_stats ? kTraversalFormat.bytes_per_pixel : 0);
+		}
+
+		bool hasTexture(int buffer_texture) const {
+			return buffer_texture != TRAVERSAL_TEXTURE || traversal_stats;
+		}
+
+		// rough estimate of the g-buffer traffic of one frame: every target is written once by the path
+		// tracing pass, the reprojection gathers up to 25 depth/normal/radiance taps from the last frame,
+		// the blur pass gathers (2 * blur + 1)^2 radiance/depth/normal taps and the post pass reads every target plus
+		// the 2x2 blurred illumination texels it upsamples with their depth and normal.
+		double bytesPerFrame(unsigned int width, unsigned int height, int blur_size) const {
+			const double pixels = double(width) * height;
+			const unsigned int radiance_bpp = kRadianceFormats[radiance].bytes_per_pixel;
+			const unsigned int depth_bpp = kDepthFormats[depth].bytes_per_pixel;
+
+			const double reprojection_taps = 25.0;
+			const double blur_taps = double(2 * blur_size + 1) * (2 * blur_size + 1);
+
+			double bytes = bytesPerPixel();
+			bytes += reprojection_taps * (depth_bpp + kNormalFormat.bytes_per_pixel + radiance_bpp) + kHistoryEmissionFormat.bytes_per_pixel + kMomentsFormat.bytes_per_pixel;
+			bytes += blur_taps * (radiance_bpp + depth_bpp + kNormalFormat.bytes_per_pixel) + kFrameColorFormat.bytes_per_pixel;
+			bytes += bytesPerPixel() + 4.0 * (kFrameColorFormat.bytes_per_pixel + depth_bpp + kNormalFormat.bytes_per_pixel);
+
+			return bytes * pixels;
+		}
+
+		TargetFormat format(int buffer_texture) const {
+			switch (buffer_texture) {
+			case SCREEN_TEXTURE: return kRadianceFormats[radiance];
+			case HISTORY_EMISSION_TEXTURE: return kHistoryEmissionFormat;
+			case DEPTH_TEXTURE: return kDepthFormats[depth];
+			case ALBEDO_TEXTURE: return kAlbedoFormat;
+			case NORMAL_TEXTURE: return kNormalFormat;
+			case MOMENTS_TEXTURE: return kMomentsFormat;
+			default: return kTraversalFormat;
+			}
+		}
+	};
+
+	// a single set of path tracing outputs, the last frame's target is read while the current one is written
+	struct RenderTarget {
+		unsigned int fbo = 0;
+		unsigned int textures[BUFFER_TEXTURE_COUNT] = { 0 };
+		unsigned int draw_buffers[BUFFER_TEXTURE_COUNT];
+		int width = 0, height = 0;
+		unsigned int last_used_frame = 0;
+
+		RenderTarget(int width, int height, const Layout& layout) : width(width), height(height) {
+			glGenFramebuffers(1, &fbo);
+			glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+			for (int i = 0; i < BUFFER_TEXTURE_COUNT; i++) {
+				if (!layout.hasTexture(i)) {
+					draw_buffers[i] = GL_NONE;
+					continue;
+				}
+
+				TargetFormat format = layout.format(i);
+				// integer textures can't be linearly filtered
+				GLint filter = format.format == GL_RED_INTEGER || format.format == GL_RG_INTEGER ? GL_NEAREST : GL_LINEAR;
+				GLint min_filter = i == MOMENTS_TEXTURE ? GL_LINEAR_MIPMAP_NEAREST : filter;
+
+				glGenTextures(1, &textures[i]);
+				glActiveTexture(GL_TEXTURE0 + kBufferTextureSlot + i);
+				glBindTexture(GL_TEXTURE_2D, textures[i]);
+				glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width, height, 0, format.format, format.type, NULL);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+				if (min_filter != filter) glGenerateMipmap(GL_TEXTURE_2D); // allocates the levels
+
+				draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+				glFramebufferTexture2D(GL_FRAMEBUFFER, draw_buffers[i], GL_TEXTURE_2D, textures[i], 0);
+
+				glBindTexture(GL_TEXTURE_2D, 0);
+			}
+
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+
+			glDrawBuffers(BUFFER_TEXTURE_COUNT, draw_buffers);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		}
+
+		RenderTarget(const RenderTarget&) = delete;
+		RenderTarget& operator=(const RenderTarget&) = delete;
+
+		~RenderTarget() {
+			glDeleteTextures(BUFFER_TEXTURE_COUNT, textures);
+			glDeleteFramebuffers(1, &fbo);
+		}
+	};
+
+	// keeps a few recently used render targets alive so resolution changes don't reallocate every time
+	class TargetPool {
+	public:
+		Layout layout;
+		unsigned int capacity = 6;
+
+		// returns a target of the given size that isn't 'in_use', creating one (and evicting the least recently used) if needed
+		RenderTarget* acquire(int width, int height, std::initializer_list<const RenderTarget*> in_use, unsigned int frame) {
+			RenderTarget* target = nullptr;
+
+			for (auto& t : targets_) {
+				if (!isInUse_(t.get(), in_use) && t->width == width && t->height == height) {
+					target = t.get();
+					break;
+				}
+			}
+
+			if (!target) {
+				if (targets_.size() >= capacity) evictLeastRecentlyUsed_(in_use);
+
+				targets_.push_back(std::unique_ptr<RenderTarget>(new RenderTarget(width, height, layout)));
+				target = targets_.back().get();
+			}
+
+			target->last_used_frame = frame;
+			return target;
+		}
+
+		// destroys all targets, used when the layout changes
+		void clear() {
+			targets_.clear();
+		}
+
+		size_t size() const {
+			return targets_.size();
+		}
+
+	private:
+		std::vector<std::unique_ptr<RenderTarget>> targets_;
+
+		static bool isInUse_(const RenderTarget* target, std::initializer_list<const RenderTarget*> in_use) {
+			return std::find(in_use.begin(), in_use.end(), target) != in_use.end();
+		}
+
+		void evictLeastRecentlyUsed_(std::initializer_list<const RenderTarget*> in_use) {
+			int oldest = -1;
+			for (int i = 0; i < targets_.size(); i++) {
+				if (isInUse_(targets_[i].get(), in_use)) continue;
+				if (oldest == -1 || targets_[i]->last_used_frame < targets_[oldest]->last_used_frame)
+					oldest = i;
+			}
+
+			if (oldest != -1) targets_.erase(targets_.begin() + oldest);
+		}
+	};
+}
+
+#endif
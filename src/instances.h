@@ -0,0 +1,350 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include <chrono>
+#include "brick.h"
+
+namespace instancing {
+	// a placed copy of a model, any number of instances share the model's voxels
+	struct Instance {
+		int model = 0;
+		glm::vec3 position = glm::vec3(0.0f); // of the model's min corner before rotating
+		glm::vec3 rotation = glm::vec3(0.0f); // degrees around x, y and z, applied around the model's center
+		float scale = 1.0f;
+		glm::mat4 animation = glm::mat4(1.0f); // model space transform before the placement, see animation.h
+
+		glm::mat4 localToWorld(const glm::vec3& model_size) const {
+			glm::vec3 center = model_size * 0.5f;
+			glm::mat4 transform = glm::translate(glm::mat4(1.0f), position + center * scale);
+			transform = glm::rotate(transform, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+			transform = glm::rotate(transform, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+			transform = glm::rotate(transform, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+			transform = glm::scale(transform, glm::vec3(scale));
+			return glm::translate(transform, -center) * animation;
+		}
+	};
+
+	// top-level BVH node, two RGBA32I texels on the GPU with the bounds read back as float bits. inner nodes have
+	// a count of 0 and their children at left_first and left_first + 1, leaves hold count instances from left_first
+	struct Node {
+		glm::vec3 min;
+		int left_first;
+		glm::vec3 max;
+		int count;
+	};
+	static_assert(sizeof(Node) == 32, "Node has to be two vec4 texels");
+
+	// Top-level acceleration structure over the instances. Models are grids of bricks like the brick map, their
+	// voxels are packed into one buffer texture. The BVH over the instances' world bounds is refit when they move
+	// and rebuilt when they are added or the refit bounds got too loose, then nodes and instances are uploaded
+	// together: the shader walks the BVH and traverses each instance's grid with the ray moved into its space.
+	// After a refit only the nodes and the range of moved instances are uploaded again.
+	class TopLevel
+	{
+	public:
+		static const int kLeafSize = 2;
+		static constexpr float kRebuildRatio = 2.0f; // refit node area over the built one that triggers a rebuild
+
+		std::vector<Instance> instances; // call moved() after changing their transforms or models
+
+		// last update, for the debug window
+		unsigned int builds = 0, refits = 0;
+		float last_update_ms = 0.0f;
+		size_t last_upload_bytes = 0;
+
+		// voxels are brick indices of the scene, the height has to be a multiple of 8. returns the model index
+		int addModel(const VoxelGrid& grid) {
+			models_.push_back({ int(model_data_.size()), grid.size });
+			model_data_.insert(model_data_.end(), grid.data.begin(), grid.data.end());
+			models_dirty_ = true;
+			return int(models_.size()) - 1;
+		}
+
+		int addInstance(const Instance& instance) {
+			instances.push_back(instance);
+			structure_dirty_ = true;
+			return int(instances.size()) - 1;
+		}
+
+		void moved(int instance) {
+			moved_.push_back(instance);
+		}
+
+		int count() const {
+			return int(instances.size());
+		}
+
+		int nodeCount() const {
+			return int(nodes_.size());
+		}
+
+		glm::ivec3 modelSize(int model) const {
+			return models_[model].size;
+		}
+
+		// first texel of the instance records, they follow the nodes
+		int instanceBase() const {
+			return int(nodes_.size()) * 2;
+		}
+
+		// refits or rebuilds after changes and uploads. returns whether anything changed
+		bool update(unsigned int instances_slot, unsigned int models_slot) {
+			if (!structure_dirty_ && moved_.empty() && !models_dirty_) return false;
+			auto start = std::chrono::steady_clock::now();
+
+			if (models_dirty_) uploadModels_(models_slot);
+
+			bool rebuild = structure_dirty_ || nodes_.empty();
+			if (rebuild) {
+				bounds_.resize(instances.size());
+				for (size_t i = 0; i < instances.size(); i++) bounds_[i] = worldBounds_(instances[i]);
+				build_();
+			}
+			else {
+				for (int i : moved_) bounds_[i] = worldBounds_(instances[i]);
+				refit_();
+				if (area_() > kRebuildRatio * built_area_) {
+					build_();
+					rebuild = true;
+				}
+			}
+
+			if (rebuild) upload_(instances_slot);
+			else uploadMoved_();
+
+			moved_.clear();
+			structure_dirty_ = models_dirty_ = false;
+
+			last_update_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+			return true;
+		}
+
+		void destroy() {
+			glDeleteTextures(1, &instances_tex_);
+			glDeleteTextures(1, &models_tex_);
+			glDeleteBuffers(1, &instances_buffer_);
+			glDeleteBuffers(1, &models_buffer_);
+			instances_tex_ = models_tex_ = instances_buffer_ = models_buffer_ = 0;
+		}
+
+	private:
+		struct Model {
+			int offset; // in texels of the models buffer
+			glm::ivec3 size;
+		};
+
+		struct Bounds {
+			glm::vec3 min = glm::vec3(1e30f);
+			glm::vec3 max = glm::vec3(-1e30f);
+
+			void grow(const Bounds& other) {
+				min = glm::min(min, other.min);
+				max = glm::max(max, other.max);
+			}
+
+			float area() const {
+				glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+				return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+			}
+		};
+
+		// world to model space as three rows of an affine matrix, then the model's grid
+		struct GpuInstance {
+			glm::vec4 rows[3];
+			int model_offset;
+			glm::ivec3 model_size;
+		};
+		static_assert(sizeof(GpuInstance) == 64, "GpuInstance has to be four vec4 texels");
+
+		std::vector<Model> models_;
+		std::vector<uint32_t> model_data_;
+
+		std::vector<Node> nodes_;
+		std::vector<int> order_; // instances in leaf order
+		std::vector<int> records_; // record of every instance, inverse of order_
+		std::vector<Bounds> bounds_;
+		float built_area_ = 0.0f;
+
+		std::vector<glm::ivec4> texels_; // copy of the uploaded buffer
+		std::vector<int> moved_;
+		bool structure_dirty_ = false, models_dirty_ = false;
+
+		unsigned int instances_buffer_ = 0, instances_tex_ = 0;
+		unsigned int models_buffer_ = 0, models_tex_ = 0;
+
+		Bounds worldBounds_(const Instance& instance) const {
+			glm::vec3 size = glm::vec3(models_[instance.model].size);
+			glm::mat4 transform = instance.localToWorld(size);
+
+			Bounds bounds;
+			for (int i = 0; i < 8; i++) {
+				glm::vec3 corner = size * glm::vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+				glm::vec3 world = glm::vec3(transform * glm::vec4(corner, 1.0f));
+				bounds.min = glm::min(bounds.min, world);
+				bounds.max = glm::max(bounds.max, world);
+			}
+			return bounds;
+		}
+
+		void build_() {
+			nodes_.clear();
+			order_.resize(instances.size());
+			std::iota(order_.begin(), order_.end(), 0);
+
+			if (!instances.empty()) {
+				nodes_.push_back(Node());
+				buildNode_(0, 0, int(instances.size()));
+			}
+
+			built_area_ = area_();
+			builds++;
+		}
+
+		// median split of the centroids along their longest axis
+		void buildNode_(int node, int first, int count) {
+			Bounds bounds, centroids;
+			for (int i = first; i < first + count; i++) {
+				const Bounds& b = bounds_[order_[i]];
+				bounds.grow(b);
+				glm::vec3 centroid = (b.min + b.max) * 0.5f;
+				centroids.grow({ centroid, centroid });
+			}
+
+			nodes_[node].min = bounds.min;
+			nodes_[node].max = bounds.max;
+
+			if (count <= kLeafSize) {
+				nodes_[node].left_first = first;
+				nodes_[node].count = count;
+				return;
+			}
+
+			glm::vec3 extent = centroids.max - centroids.min;
+			int axis = extent.x > extent.y && extent.x > extent.z ? 0 : extent.y > extent.z ? 1 : 2;
+
+			int mid = first + count / 2;
+			std::nth_element(order_.begin() + first, order_.begin() + mid, order_.begin() + first + count, [&](int a, int b) {
+				return bounds_[a].min[axis] + bounds_[a].max[axis] < bounds_[b].min[axis] + bounds_[b].max[axis];
+			});
+
+			int left = int(nodes_.size());
+			nodes_.push_back(Node());
+			nodes_.push_back(Node());
+			nodes_[node].left_first = left;
+			nodes_[node].count = 0;
+
+			buildNode_(left, first, mid - first);
+			buildNode_(left + 1, mid, first + count - mid);
+		}
+
+		// children always come after their parent, so one backwards pass updates the whole tree
+		void refit_() {
+			for (int node = int(nodes_.size()) - 1; node >= 0; node--) {
+				Node& n = nodes_[node];
+				Bounds bounds;
+				if (n.count > 0) for (int i = n.left_first; i < n.left_first + n.count; i++) bounds.grow(bounds_[order_[i]]);
+				else {
+					bounds.grow({ nodes_[n.left_first].min, nodes_[n.left_first].max });
+					bounds.grow({ nodes_[n.left_first + 1].min, nodes_[n.left_first + 1].max });
+				}
+				n.min = bounds.min;
+				n.max = bounds.max;
+			}
+			refits++;
+		}
+
+		// summed node surface area, proportional to the expected traversal cost
+		float area_() const {
+			float area = 0.0f;
+			for (const Node& node : nodes_) area += Bounds{ node.min, node.max }.area();
+			return area;
+		}
+
+		void writeRecord_(int record, int instance_index) {
+			const Instance& instance = instances[instance_index];
+			const Model& model = models_[instance.model];
+			glm::mat4 world_to_local = glm::inverse(instance.localToWorld(glm::vec3(model.size)));
+
+			GpuInstance* gpu = (GpuInstance*)(texels_.data() + nodes_.size() * 2) + record;
+			for (int row = 0; row < 3; row++)
+				gpu->rows[row] = glm::vec4(world_to_local[0][row], world_to_local[1][row], world_to_local[2][row], world_to_local[3][row]);
+			gpu->model_offset = model.offset;
+			gpu->model_size = model.size;
+		}
+
+		void upload_(unsigned int slot) {
+			texels_.assign(nodes_.size() * 2 + instances.size() * 4, glm::ivec4(0));
+			if (!nodes_.empty()) std::memcpy(texels_.data(), nodes_.data(), nodes_.size() * sizeof(Node));
+
+			records_.resize(order_.size());
+			for (size_t i = 0; i < order_.size(); i++) {
+				records_[order_[i]] = int(i);
+				writeRecord_(int(i), order_[i]);
+			}
+
+			// integer texels so the offsets and counts reach the shader untouched, a float format may flush their
+			// bit patterns as denormals
+			createBufferTexture_(&instances_buffer_, &instances_tex_, GL_RGBA32I, slot);
+			glBindBuffer(GL_TEXTURE_BUFFER, instances_buffer_);
+			glBufferData(GL_TEXTURE_BUFFER, std::max(texels_.size(), size_t(1)) * sizeof(glm::ivec4), texels_.empty() ? NULL : texels_.data(), GL_DYNAMIC_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+			last_upload_bytes = texels_.size() * sizeof(glm::ivec4);
+		}
+
+		// the refit nodes and the range of records between the first and the last moved instance
+		void uploadMoved_() {
+			std::memcpy(texels_.data(), nodes_.data(), nodes_.size() * sizeof(Node));
+
+			int first = int(order_.size()), last = -1;
+			for (int i : moved_) {
+				int record = records_[i];
+				writeRecord_(record, i);
+				first = std::min(first, record);
+				last = std::max(last, record);
+			}
+
+			size_t nodes_bytes = nodes_.size() * sizeof(Node);
+			size_t records_offset = nodes_bytes + first * sizeof(GpuInstance);
+			size_t records_bytes = last >= first ? (last - first + 1) * sizeof(GpuInstance) : 0;
+
+			glBindBuffer(GL_TEXTURE_BUFFER, instances_buffer_);
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, nodes_bytes, texels_.data());
+			if (records_bytes) glBufferSubData(GL_TEXTURE_BUFFER, records_offset, records_bytes, (const char*)texels_.data() + records_offset);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+			last_upload_bytes = nodes_bytes + records_bytes;
+		}
+
+		void uploadModels_(unsigned int slot) {
+			createBufferTexture_(&models_buffer_, &models_tex_, GL_R32UI, slot);
+			glBindBuffer(GL_TEXTURE_BUFFER, models_buffer_);
+			glBufferData(GL_TEXTURE_BUFFER, std::max(model_data_.size(), size_t(1)) * sizeof(uint32_t), model_data_.empty() ? NULL : model_data_.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		}
+
+		// the texture stays bound to its unit, reallocating the buffer's storage keeps it attached
+		static void createBufferTexture_(unsigned int* buffer, unsigned int* texture, GLenum format, unsigned int slot) {
+			if (*texture) return;
+
+			glGenBuffers(1, buffer);
+			glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+			glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+
+			glGenTextures(1, texture);
+			glActiveTexture(GL_TEXTURE0 + slot);
+			glBindTexture(GL_TEXTURE_BUFFER, *texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		}
+	};
+}
+
+#endif
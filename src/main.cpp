@@ -6,39 +6,66 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <map>
 #include <queue>
+#include <random>
+#include <chrono>
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
 #include "shader.h"
+#include "shadercache.h"
 #include "camera.h"
 #include "brick.h"
 #include "drawutil.h"
 #include "mathutil.h"
+#include "gbuffer.h"
+#include "resolution.h"
+#include "benchmark.h"
+#include "profiler.h"
+#include "stats.h"
+#include "bluenoise.h"
+#include "sky.h"
+#include "taa.h"
+#include "blur.h"
+#include "collision.h"
+#include "instances.h"
+#include "animation.h"
+#include "brickify.h"
+#include "minecraft.h"
+#include "paging.h"
 
 
-enum BufferTexture {
-	SCREEN_TEXTURE = 0,
-	HISTORY_TEXTURE,
-	DEPTH_TEXTURE,
-	ALBEDO_TEXTURE,
-	NORMAL_TEXTURE,
-	EMISSION_TEXTURE,
-};
-
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
 void mouseCallback(GLFWwindow* window, double x_pos, double y_pos);
 void scrollCallback(GLFWwindow* window, double x_offset, double y_offset);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 void processInput(GLFWwindow* window);
+void processMovement(GLFWwindow* window, float time_step);
+void simulate(GLFWwindow* window);
 void createDebugImGuiWindow();
 unsigned int createVAO();
-void draw(Shader shader, Shader post_shader, unsigned int vao);
-bool loadScene(Shader shader, const std::string scene_path, unsigned int* map_texture, unsigned int* bricks_texture, unsigned int* mats_texture);
+void draw(Shader& shader, Shader& prepass_shader, Shader& blur_shader, Shader& post_shader, Shader& taa_shader, unsigned int vao);
+void tracePass(Shader& shader, gbuffer::RenderTarget* target, bool primary_only, const gbuffer::RenderTarget* last, unsigned int vao);
+void depthPrepass(Shader& shader, unsigned int vao);
+void postProcess(Shader& post_shader, unsigned int fbo, unsigned int vao);
+bool loadScene(const std::string scene_path, unsigned int* map_texture, unsigned int* bricks_texture, unsigned int* mats_texture);
+void setSceneUniforms(Shader& shader);
+ShaderDefines traceDefines();
+void requestTraceVariant();
+void updateProgressive();
 bool isPositionOccupied(const glm::vec3 pos);
+void runCollisionBenchmark();
 void drawSelectedBrickLines();
+void uploadBrickMap();
+void uploadDilatedMap();
+void updateSky();
+void updateInstances();
+void updateWorldLoading();
+void updatePaging();
 
 
 // constants
@@ -46,7 +73,10 @@ const std::string	kAssetsFolder = "assets/";
 
 const bool			kVSYNC = false;
 
-const char* kOutputNames[] = { "Result", "Composite", "Illumination", "Albedo", "Emission", "Normal", "Depth", "History" };
+const char* kIndirectScaleNames[] = { "Full", "Half", "Quarter" };
+const char* kUpscaleModeNames[] = { "Native", "Checkerboard (1/2)", "Interleaved (1/4)" };
+const char* kSamplerNames[] = { "White Noise (PCG)", "Blue Noise", "Sobol (Owen Scrambled)" };
+const char* kOutputNames[] = { "Result", "Composite", "Illumination", "Albedo", "Emission", "Normal", "Depth", "History", "Traversal Steps", "Sample Need" };
 const unsigned int	kFPSAverageAmount = 80;
 
 const float			kMaxHighlightDistance = 8.;
@@ -56,6 +86,26 @@ const glm::vec3		kCrosshairColor(0.2);
 const float			kCrosshairSize = 0.02;
 const float			kLineWidth = 2;
 
+const double		kIdleFrameTime = 0.1; // seconds between presents once a still frame converged
+
+const float			kSimulationStep = 1.0f / 120.0f;
+const int			kMaxSimulationSteps = 16; // per frame, a longer stall is dropped instead of caught up
+
+const unsigned int	kBlueNoiseSlot = 3;
+const int			kBlueNoiseSize = 64;
+const unsigned int	kDilatedMapSlot = 4;
+const unsigned int	kCoarseDepthSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 3; // after the post pass' illumination textures
+
+const unsigned int	kSkyLutSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 4;
+const int			kSkyLutWidth = 128, kSkyLutHeight = 64;
+
+const unsigned int	kInstancesSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 5;
+const unsigned int	kModelsSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 6;
+const unsigned int	kPageTableSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 7;
+const unsigned int	kBrickLodSlot = kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 8;
+
+const int			kPrepassTile = 8; // render pixels per coarse depth texel
+
 
 
 // window
@@ -75,24 +125,155 @@ bool first_mouse = true;
 std::unique_ptr<BrickMap> brick_map;
 std::vector<std::unique_ptr<Brick>> bricks;
 
+// instanced models placed by the scene file
+instancing::TopLevel instances;
+int selected_instance = 0;
+
+Animator animator;
+double animation_time = 0.0; // advanced by the simulation steps while playing
+
+// minecraft regions streamed into the map after the scene loaded
+minecraft::WorldLoader world_loader;
+bool world_loading = false;
+
+// or paged in around the camera, the map then holds no cells and the page pool takes the map's texture unit
+PagedMap paged_map;
+
 // timing
 float delta_time = 0.0f;	// time between current frame and last frame
 float last_frame_time = 0.0f;
+
+// fixed timestep simulation. between steps camera.position holds the rendered position, interpolated
+// between the last two simulated ones
+float simulation_time = 0.0f; // accumulated and not simulated yet
+glm::vec3 simulated_position, previous_simulated_position;
+int simulation_steps = 0; // in the last frame
 unsigned int frame_count = 0;
 
 // fps
 float frame_times_sum = 0.0f;
 std::queue<float> last_frame_times;
 
+// per frame uniforms shared by the path tracing and post processing programs, std140 layout of the FrameData block
+struct FrameData {
+	glm::mat4 cam_rotation;
+	glm::mat4 last_cam_rotation;
+	glm::vec3 cam_position;
+	float pad0;
+	glm::vec3 last_cam_position;
+	float pad1;
+	glm::uvec2 render_resolution;
+	unsigned int frame_count;
+	int upscale_mode;
+	int indirect_scale;
+	int pad2;
+	glm::vec2 jitter;
+	glm::vec2 last_jitter;
+	float pad3[2];
+};
+static_assert(sizeof(FrameData) == 208, "FrameData has to match the std140 layout of the shader block");
+
+const unsigned int kFrameDataBinding = 0;
+UniformBuffer frame_ubo;
+
+// shaders
+ProgramCache program_cache;
+Shader* trace_shader = nullptr;
+int trace_variant = -1;
+int pending_trace_variant = -1; // built in the background, swapped in once ready
+int max_bounces = 8; // compile time cap of the bounce loop
+int sampler_type = 1;
+
+// path length, changeable without recompiling
+int bounce_budget = 3;
+bool russian_roulette = true;
+int roulette_depth = 2; // bounces before the roulette may end a path
+bool lights_end_paths = false; // cuts the light reflected by emitters, off keeps the estimate unbiased
+
+// coarse bricks
+int lod_bounce = 2; // bounces from which every brick is traced coarse, above max_bounces disables it
+float lod_pixels = 1.0f; // primary rays trace the bricks whose coarse cells cover fewer pixels than this coarse, 0 disables it
+
+bool adaptive_sampling = false;
+float sample_budget = 1.0f; // average paths per pixel, split by need when sampling adaptively
+
+// progressive accumulation while the camera, scene and settings stay the same
+bool progressive_enabled = true;
+int progressive_target_spp = 1024;
+float progressive_target_error = 0.002f;
+bool progressive_active = false; // running average instead of the exponential history
+bool idle = false; // converged, tracing stopped and the last result is only presented again
+unsigned int progressive_frames = 0;
+ErrorEstimate error_estimate;
+
+unsigned int scene_version = 0; // bumped on every edit of the map or the sky
+
+// everything a still frame depends on, any change restarts the accumulation
+struct TraceState {
+	glm::vec3 cam_position;
+	float cam_yaw, cam_pitch;
+	unsigned int scene_version;
+	int window_width, window_height;
+	float render_scale;
+	int trace_variant, bounce_budget, roulette_depth, upscale_mode, indirect_downscale, lod_bounce;
+	bool russian_roulette, adaptive_sampling, lights_end_paths, sun_sampling;
+	float sample_budget, lod_pixels;
+
+	bool operator==(const TraceState& other) const {
+		return cam_position == other.cam_position && cam_yaw == other.cam_yaw && cam_pitch == other.cam_pitch
+			&& scene_version == other.scene_version && window_width == other.window_width && window_height == other.window_height
+			&& render_scale == other.render_scale && trace_variant == other.trace_variant && bounce_budget == other.bounce_budget
+			&& roulette_depth == other.roulette_depth && upscale_mode == other.upscale_mode && indirect_downscale == other.indirect_downscale
+			&& russian_roulette == other.russian_roulette && adaptive_sampling == other.adaptive_sampling && sample_budget == other.sample_budget
+			&& lod_bounce == other.lod_bounce && lod_pixels == other.lod_pixels && lights_end_paths == other.lights_end_paths
+			&& sun_sampling == other.sun_sampling;
+	}
+};
+TraceState last_trace_state;
+
 // frame buffers
-unsigned int fbo1, fbo2;
-unsigned int buffer_textures1[6], buffer_textures2[6];
+gbuffer::TargetPool target_pool;
+gbuffer::RenderTarget* curr_target = nullptr;
+gbuffer::RenderTarget* last_target = nullptr;
+gbuffer::RenderTarget* primary_target = nullptr; // full resolution first hits, curr_target unless the lighting is downscaled
+gbuffer::RenderTarget* last_primary_target = nullptr;
+
+// primary ray acceleration
+bool depth_prepass = true;
+bool reuse_primary_hits = true;
+unsigned int prepass_fbo = 0, prepass_tex = 0;
+glm::ivec2 prepass_size(0);
+
+// temporal anti-aliasing
+TemporalAA temporal_aa;
+bool taa_enabled = true;
+glm::vec2 last_jitter(0.0f); // of the last traced frame
+int render_width = window_width, render_height = window_height;
+
+ResolutionController resolution;
+int upscale_mode = 0;
+int indirect_downscale = 0; // log2 of the indirect lighting resolution divider
+
+Benchmark benchmark;
+Profiler profiler;
+TraversalStats traversal_stats;
+ConvergenceStats convergence_stats;
+
+collision::VoxelCollider collider;
 
 unsigned int scene_tex, bricks_tex, mats_tex;
+unsigned int blue_noise_tex;
+unsigned int dilated_map_tex = 0;
+unsigned int brick_lod_tex = 0;
+unsigned int sky_lut_tex;
+
+sky::Parameters sky_params;
+bool sun_sampling = true;
 
 int selected_output = 0;
 float gamma = 2.2f;
 int blur_size = 2;
+IlluminationBlur illumination_blur; // blur_size at the illumination's resolution, upsampled by the post pass
 
 glm::ivec3 selected_brick;
 glm::ivec3 selected_brick_normal;
@@ -143,28 +324,84 @@ int main(int argc, const char* argv[]) {
 
 	unsigned int VAO = createVAO();
 
-	Shader shader("src/vertex.vert", "src/fragment.frag");
-	Shader post_process_shader("src/vertex.vert", "src/postprocessing.frag");
-
-	drawUtils::initLineShader();
-
-	// load scene
 	if (argc < 2) {
 		std::cerr << "Scene name expected as an argument. Exiting." << std::endl;
 		return 2;
 	}
 
-	if (!loadScene(shader, argv[1], &scene_tex, &bricks_tex, &mats_tex)) {
+	bool benchmark_requested = false, collision_benchmark_requested = false;
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--benchmark") benchmark_requested = true;
+		else if (arg == "--collision-benchmark") collision_benchmark_requested = true;
+		else if (arg == "--stats") target_pool.layout.traversal_stats = true;
+	}
+
+	// the drivers that support it compile these while the scene loads
+	program_cache.init((GLADloadproc)glfwGetProcAddress);
+	trace_variant = program_cache.request("src/vertex.vert", "src/fragment.frag", traceDefines());
+	int blur_variant = program_cache.request("src/vertex.vert", "src/blur.frag");
+	int post_variant = program_cache.request("src/vertex.vert", "src/postprocessing.frag");
+	int taa_variant = program_cache.request("src/vertex.vert", "src/taa.frag");
+
+	ShaderDefines prepass_defines;
+	prepass_defines["BRICK_RES"] = std::to_string(BRICK_SIZE);
+	prepass_defines["LOD_RES"] = std::to_string(BRICK_LOD_SIZE);
+	prepass_defines["MAP_CELL_BITS"] = std::to_string(MAP_CELL_BITS);
+	prepass_defines["DEPTH_PREPASS"] = "1";
+	int prepass_variant = program_cache.request("src/vertex.vert", "src/fragment.frag", prepass_defines);
+
+	drawUtils::initLineShader();
+
+	blue_noise_tex = blueNoise::createTexture(kBlueNoiseSize, kBlueNoiseSlot);
+	sky_lut_tex = sky::createLut(kSkyLutWidth, kSkyLutHeight, kSkyLutSlot, sky_params);
+
+	// load scene
+	if (!loadScene(argv[1], &scene_tex, &bricks_tex, &mats_tex)) {
 		std::cerr << "Failed to load scene. Exiting." << std::endl;
 		glDeleteTextures(1, &scene_tex);
 		glDeleteTextures(1, &bricks_tex);
 		glDeleteTextures(1, &mats_tex);
+		glDeleteTextures(1, &brick_lod_tex);
 		glfwTerminate();
 		return 1;
 	}
 
-	glGenFramebuffers(1, &fbo1);
-	glGenFramebuffers(1, &fbo2);
+	trace_shader = &program_cache.wait(trace_variant);
+	Shader& blur_shader = program_cache.wait(blur_variant);
+	Shader& post_process_shader = program_cache.wait(post_variant);
+	Shader& taa_shader = program_cache.wait(taa_variant);
+	Shader& prepass_shader = program_cache.wait(prepass_variant);
+
+	frame_ubo.create(sizeof(FrameData), kFrameDataBinding);
+	trace_shader->bindUniformBlock("FrameData", kFrameDataBinding);
+	post_process_shader.bindUniformBlock("FrameData", kFrameDataBinding);
+	taa_shader.bindUniformBlock("FrameData", kFrameDataBinding);
+	prepass_shader.bindUniformBlock("FrameData", kFrameDataBinding);
+
+	setSceneUniforms(*trace_shader);
+	setSceneUniforms(prepass_shader);
+
+	// the traversal stats toggle is the most likely switch, have its permutation ready
+	if (program_cache.parallelCompile()) {
+		target_pool.layout.traversal_stats = !target_pool.layout.traversal_stats;
+		program_cache.request("src/vertex.vert", "src/fragment.frag", traceDefines());
+		target_pool.layout.traversal_stats = !target_pool.layout.traversal_stats;
+	}
+
+	collider = collision::VoxelCollider(&isPositionOccupied, 1.0f / BRICK_SIZE, brick_map->size * BRICK_SIZE);
+	if (collision_benchmark_requested) runCollisionBenchmark();
+
+	// A/B the temporal upscaling modes against native resolution
+	if (benchmark_requested) {
+		for (int i = 0; i < IM_ARRAYSIZE(kUpscaleModeNames); i++)
+			benchmark.addConfig(kUpscaleModeNames[i], [i]() { upscale_mode = i; russian_roulette = true; adaptive_sampling = false; sun_sampling = true; });
+		benchmark.addConfig("Native, no roulette", []() { upscale_mode = 0; russian_roulette = false; adaptive_sampling = false; sun_sampling = true; });
+		benchmark.addConfig("Native, adaptive", []() { upscale_mode = 0; russian_roulette = true; adaptive_sampling = true; sun_sampling = true; });
+		benchmark.addConfig("Native, no sun sampling", []() { upscale_mode = 0; russian_roulette = true; adaptive_sampling = false; sun_sampling = false; });
+
+		benchmark.start(camera);
+	}
 
 	framebufferSizeCallback(window, window_width, window_height);
 
@@ -176,48 +413,123 @@ int main(int argc, const char* argv[]) {
 		delta_time = current_frame_time - last_frame_time;
 		last_frame_time = current_frame_time;
 
-		camera.Update(delta_time, &isPositionOccupied, brick_map->size * 8);
+		// a converged still frame only needs presenting when something happens
+		if (idle) glfwWaitEventsTimeout(kIdleFrameTime);
+		else glfwPollEvents();
 
-		glfwPollEvents();
+		{
+			Profiler::CpuScope scope(profiler, "input");
+			processInput(window);
+			simulate(window);
+		}
 
-		processInput(window);
+		{
+			Profiler::CpuScope scope(profiler, "picking");
+
+			// raycast selected brick
+			util::RayHit hit = util::rayCast(camera.position, camera.front, &isPositionOccupied, 1. / BRICK_SIZE, brick_map->size * BRICK_SIZE, kMaxHighlightDistance);
+
+			if (hit.hit) selected_brick = camera.position + (hit.dist + 0.0001f) * camera.front;
+			else selected_brick = glm::ivec3(-1);
+
+			selected_brick_normal = hit.normal;
+		}
+
+		if (benchmark.isRunning()) {
+			benchmark.updateCamera(camera);
+			simulated_position = previous_simulated_position = camera.position;
+		}
+
+		// swap in a finished permutation, the previous one keeps rendering until then
+		program_cache.poll();
+		if (pending_trace_variant != -1 && program_cache.state(pending_trace_variant) != ProgramCache::PENDING) {
+			if (program_cache.isReady(pending_trace_variant)) {
+				trace_variant = pending_trace_variant;
+				trace_shader = &program_cache.get(trace_variant);
+				trace_shader->bindUniformBlock("FrameData", kFrameDataBinding);
+				setSceneUniforms(*trace_shader);
+			}
+			pending_trace_variant = -1;
+		}
 
-		// raycast selected brick
-		util::RayHit hit = util::rayCast(camera.position, camera.front, &isPositionOccupied, 1. / BRICK_SIZE, brick_map->size * BRICK_SIZE, kMaxHighlightDistance);
+		updateInstances();
+		updateWorldLoading();
+		updatePaging();
+		updateProgressive();
 
-		if (hit.hit) selected_brick = camera.position + (hit.dist + 0.0001f) * camera.front;
-		else selected_brick = glm::ivec3(-1);
+		draw(*trace_shader, prepass_shader, blur_shader, post_process_shader, taa_shader, VAO);
 
-		selected_brick_normal = hit.normal;
+		{
+			Profiler::CpuScope scope(profiler, "ui");
 
-		draw(shader, post_process_shader, VAO);
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
 
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
+			createDebugImGuiWindow();
 
-		createDebugImGuiWindow();
+			ImGui::Render();
+		}
 
-		ImGui::Render();
+		profiler.beginGpu("imgui");
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		profiler.endGpu();
 
-		// swap buffers
-		std::swap(fbo1, fbo2);
-		std::swap(buffer_textures1, buffer_textures2);
+		// this frame's target is read as the last frame next time
+		last_target = curr_target;
+		last_primary_target = primary_target;
 
 		glfwSwapBuffers(window);
 
 		last_camera = camera;
+
+		profiler.record("frame", delta_time * 1000.0f);
+		profiler.endFrame();
+		// the scale is held while accumulating, a change would restart it
+		if (!progressive_active) resolution.update(profiler.lastMs("primary") + profiler.lastMs("path trace") + profiler.lastMs("post"));
+
+		if (benchmark.isRunning()) {
+			if (target_pool.layout.traversal_stats) {
+				benchmark.addMetric("mean steps", traversal_stats.mean_steps);
+				benchmark.addMetric("p95 steps", traversal_stats.p95_steps);
+				benchmark.addMetric("max steps", traversal_stats.max_steps);
+				benchmark.addMetric("rays", double(traversal_stats.total_rays));
+				benchmark.addMetric("Mrays/s", traversal_stats.total_rays / (glm::max(profiler.lastMs("primary") + profiler.lastMs("path trace"), 0.001f) * 1e3));
+				benchmark.addMetric("frame change", convergence_stats.mean_change);
+			}
+
+			benchmark.endFrame(resolution.last_gpu_ms, delta_time * 1000.0f);
+
+			if (!benchmark.isRunning()) {
+				benchmark.printResults(std::cout);
+				glfwSetWindowShouldClose(window, true);
+			}
+		}
 	}
 
 	// delete all textures
 	glDeleteTextures(1, &scene_tex);
 	glDeleteTextures(1, &bricks_tex);
 	glDeleteTextures(1, &mats_tex);
-	for (int i = 0; i < sizeof(buffer_textures1) / sizeof(unsigned int); i++) {
-		glDeleteTextures(1, &buffer_textures1[i]);
-		glDeleteTextures(1, &buffer_textures2[i]);
-	}
+	glDeleteTextures(1, &blue_noise_tex);
+	glDeleteTextures(1, &sky_lut_tex);
+	glDeleteTextures(1, &dilated_map_tex);
+	glDeleteTextures(1, &brick_lod_tex);
+	glDeleteTextures(1, &prepass_tex);
+	glDeleteFramebuffers(1, &prepass_fbo);
+	animator.stop();
+	paged_map.destroy(); // joins the pager's workers, they read chunks through the world loader
+	world_loader.stop();
+	instances.destroy();
+	temporal_aa.destroy();
+	illumination_blur.destroy();
+	target_pool.clear();
+	profiler.destroy();
+	frame_ubo.destroy();
+	program_cache.destroy();
+	traversal_stats.destroy();
+	convergence_stats.destroy();
+	error_estimate.destroy();
 
 	glfwTerminate();
 	ImGui_ImplOpenGL3_Shutdown();
@@ -232,68 +544,7 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 	glViewport(0, 0, width, height);
 	window_width = width;
 	window_height = height;
-
-	for (int i = 0; i < sizeof(buffer_textures1) / sizeof(unsigned int); i++) {
-		glDeleteTextures(1, &buffer_textures1[i]);
-		glDeleteTextures(1, &buffer_textures2[i]);
-	}
-
-	unsigned int attachments[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3, GL_COLOR_ATTACHMENT4, GL_COLOR_ATTACHMENT5 };
-
-	for (int i = 0; i < 2; i++)
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo1);
-		// generate textures
-		for (int i = 0; i < sizeof(buffer_textures1) / sizeof(unsigned int); i++) {
-			glGenTextures(1, &buffer_textures1[i]);
-			glActiveTexture(GL_TEXTURE0 + 5 + i);
-			glBindTexture(GL_TEXTURE_2D, buffer_textures1[i]);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-			glFramebufferTexture2D(GL_FRAMEBUFFER, attachments[i], GL_TEXTURE_2D, buffer_textures1[i], 0);
-
-			glBindTexture(GL_TEXTURE_2D, 0);
-		}
-
-		glActiveTexture(GL_TEXTURE0 + 5 + SCREEN_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[SCREEN_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, window_width, window_height, 0, GL_RGB, GL_FLOAT, NULL);
-
-		glActiveTexture(GL_TEXTURE0 + 5 + HISTORY_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[HISTORY_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, window_width, window_height, 0, GL_RED, GL_FLOAT, NULL);
-
-		glActiveTexture(GL_TEXTURE0 + 5 + DEPTH_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[DEPTH_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, window_width, window_height, 0, GL_RED, GL_FLOAT, NULL);
-
-		glActiveTexture(GL_TEXTURE0 + 5 + ALBEDO_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[ALBEDO_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, window_width, window_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-
-		glActiveTexture(GL_TEXTURE0 + 5 + NORMAL_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[NORMAL_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8I, window_width, window_height, 0, GL_RGB_INTEGER, GL_INT, NULL);
-
-		glActiveTexture(GL_TEXTURE0 + 5 + EMISSION_TEXTURE);
-		glBindTexture(GL_TEXTURE_2D, buffer_textures1[EMISSION_TEXTURE]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, window_width, window_height, 0, GL_RED, GL_FLOAT, NULL);
-
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-
-		glDrawBuffers(sizeof(attachments) / sizeof(unsigned int), attachments);
-
-		std::swap(fbo1, fbo2);
-		std::swap(buffer_textures1, buffer_textures2);
-	}
-
-	glBindBuffer(GL_FRAMEBUFFER, 0);
-
-	drawUtils::passResolution(window_width, window_height);
+	// render targets follow the window size on the next draw, see draw()
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -307,21 +558,45 @@ void processInput(GLFWwindow* window)
 		is_mouse_enabled = true;
 		do_next_focus = true;
 	}
+}
+
+// runs the simulation steps the frame time covers, so movement and collisions don't depend on the frame rate
+void simulate(GLFWwindow* window) {
+	simulation_time += delta_time;
+	camera.position = simulated_position;
 
-	glm::ivec3 map_size = brick_map->size * BRICK_SIZE;
+	simulation_steps = 0;
+	while (simulation_time >= kSimulationStep && simulation_steps < kMaxSimulationSteps) {
+		previous_simulated_position = camera.position;
 
+		processMovement(window, kSimulationStep);
+		camera.Update(kSimulationStep, collider);
+		if (animator.playing) animation_time += kSimulationStep;
+
+		simulation_time -= kSimulationStep;
+		simulation_steps++;
+	}
+	simulation_time = glm::mod(simulation_time, kSimulationStep);
+
+	simulated_position = camera.position;
+	camera.position = glm::mix(previous_simulated_position, simulated_position, simulation_time / kSimulationStep);
+}
+
+// movement keys, once per simulation step
+void processMovement(GLFWwindow* window, float time_step)
+{
 	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-		camera.ProcessKeyboard(FORWARD, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(FORWARD, time_step, collider);
 	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-		camera.ProcessKeyboard(BACKWARD, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(BACKWARD, time_step, collider);
 	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-		camera.ProcessKeyboard(LEFT, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(LEFT, time_step, collider);
 	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-		camera.ProcessKeyboard(RIGHT, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(RIGHT, time_step, collider);
 	if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-		camera.ProcessKeyboard(UP, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(UP, time_step, collider);
 	if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-		camera.ProcessKeyboard(DOWN, delta_time, &isPositionOccupied, map_size);
+		camera.ProcessKeyboard(DOWN, time_step, collider);
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -358,23 +633,61 @@ void scrollCallback(GLFWwindow* window, double x_offset, double y_offset)
 }
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+	if (paged_map.active()) return; // edits of paged worlds would be lost on eviction
+
 	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !is_mouse_enabled && selected_brick != glm::ivec3(-1)) {
 		brick_map->setVoxel(selected_brick.x, selected_brick.y, selected_brick.z, 0); // delete selected brick
 
-		// update texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, scene_tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, brick_map->size.x * brick_map->size.y / 8, brick_map->size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, brick_map->data.data());
+		uploadBrickMap();
 	}
 
 	if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS && !is_mouse_enabled && selected_brick != glm::ivec3(-1)) {
 		brick_map->setVoxel(selected_brick.x + selected_brick_normal.x, selected_brick.y + selected_brick_normal.y, selected_brick.z + selected_brick_normal.z, 1); // place brick
 
-		// update texture
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, scene_tex);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, brick_map->size.x * brick_map->size.y / 8, brick_map->size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, brick_map->data.data());
+		uploadBrickMap();
+	}
+}
+
+void uploadBrickMap() {
+	Profiler::CpuScope scope(profiler, "upload");
+
+	scene_version++;
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, scene_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, brick_map->size.x * brick_map->size.y / MAP_CELLS_PER_WORD, brick_map->size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, brick_map->data.data());
+
+	uploadDilatedMap();
+}
+
+// bricks occupied by themselves or one of their 26 neighbours, padded by a brick on every side, for the depth prepass
+void uploadDilatedMap() {
+	if (paged_map.active()) return; // the prepass is off, the map's cells aren't all there
+	glm::ivec3 size = brick_map->size + 2;
+	std::vector<uint8_t> dilated(size_t(size.x) * size.y * size.z, 0);
+
+	for (int z = 0; z < brick_map->size.z; z++) for (int y = 0; y < brick_map->size.y; y++) for (int x = 0; x < brick_map->size.x; x++) {
+		if (brick_map->getVoxel(x, y, z) == 0) continue;
+
+		for (int dz = 0; dz < 3; dz++) for (int dy = 0; dy < 3; dy++) for (int dx = 0; dx < 3; dx++)
+			dilated[(size_t(z + dz) * size.y + (y + dy)) * size.x + (x + dx)] = 1;
 	}
+
+	glActiveTexture(GL_TEXTURE0 + kDilatedMapSlot);
+	if (!dilated_map_tex) {
+		glGenTextures(1, &dilated_map_tex);
+		glBindTexture(GL_TEXTURE_3D, dilated_map_tex);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_3D, dilated_map_tex);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_R8UI, size.x, size.y, size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_BYTE, dilated.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 void createDebugImGuiWindow() {
@@ -407,15 +720,146 @@ void createDebugImGuiWindow() {
 	}
 
 	ImGui::Text("Position: %.2f, %.2f, %.2f", camera.position.x, camera.position.y, camera.position.z);
+	ImGui::Text("Simulation: %d Hz, %d steps", int(1.0f / kSimulationStep + 0.5f), simulation_steps);
 
 	ImGui::Checkbox("No Clip Fly", &camera.no_clip);
 
 	if (ImGui::CollapsingHeader("Visuals")) {
 		ImGui::SliderFloat("Gamma", &gamma, 1.0f, 5.0f);
 		ImGui::SliderInt("Blur Radius", &blur_size, 0, 10);
+		ImGui::SliderInt("Max Bounces", &max_bounces, 0, 8);
+		if (ImGui::IsItemDeactivatedAfterEdit()) requestTraceVariant(); // compile time constant, build once the slider is released
+		ImGui::SliderInt("Bounce Budget", &bounce_budget, 0, max_bounces);
+		ImGui::Checkbox("Russian Roulette", &russian_roulette);
+		if (russian_roulette) ImGui::SliderInt("Roulette Depth", &roulette_depth, 0, max_bounces);
+		ImGui::Checkbox("End Paths At Lights", &lights_end_paths);
+		ImGui::SliderInt("Coarse Bricks From Bounce", &lod_bounce, 1, max_bounces + 1);
+		ImGui::SliderFloat("Coarse Brick Pixels", &lod_pixels, 0.0f, 4.0f);
+		ImGui::Checkbox("Adaptive Sampling", &adaptive_sampling);
+		if (adaptive_sampling) ImGui::SliderFloat("Paths/Pixel", &sample_budget, 0.25f, 4.0f);
+		if (ImGui::Combo("Sampler", &sampler_type, kSamplerNames, IM_ARRAYSIZE(kSamplerNames))) requestTraceVariant();
 		ImGui::Combo("Output", &selected_output, kOutputNames, IM_ARRAYSIZE(kOutputNames));
 	}
 
+	if (brick_map->env_color == glm::vec3(-1) && ImGui::CollapsingHeader("Sky")) {
+		bool changed = ImGui::SliderFloat("Sun Azimuth", &sky_params.sun_azimuth, -180.0f, 180.0f);
+		changed |= ImGui::SliderFloat("Sun Elevation", &sky_params.sun_elevation, -10.0f, 90.0f);
+		changed |= ImGui::SliderFloat("Sun Intensity", &sky_params.sun_intensity, 0.0f, 200.0f);
+		changed |= ImGui::ColorEdit3("Sun Color", &sky_params.sun_color.x);
+		changed |= ImGui::SliderFloat("Sun Sharpness", &sky_params.sun_exponent, 10.0f, 2000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+		changed |= ImGui::SliderFloat("Sky Intensity", &sky_params.sky_intensity, 0.0f, 4.0f);
+		if (changed) updateSky();
+
+		ImGui::Checkbox("Sample Sun", &sun_sampling);
+	}
+
+	if (instances.count() > 0 && ImGui::CollapsingHeader("Instances")) {
+		ImGui::SliderInt("Instance", &selected_instance, 0, instances.count() - 1);
+		instancing::Instance& instance = instances.instances[selected_instance];
+
+		bool moved = ImGui::DragFloat3("Instance Position", &instance.position.x, 0.05f);
+		moved |= ImGui::DragFloat3("Instance Rotation", &instance.rotation.x, 1.0f);
+		moved |= ImGui::DragFloat("Instance Scale", &instance.scale, 0.01f, 0.05f, 16.0f);
+		if (moved) instances.moved(selected_instance);
+
+		ImGui::Text("%d instances, %d nodes", instances.count(), instances.nodeCount());
+		ImGui::Text("Builds: %u, refits: %u", instances.builds, instances.refits);
+		ImGui::Text("Last update: %.3f ms, %zu bytes", instances.last_update_ms, instances.last_upload_bytes);
+	}
+
+	if (paged_map.active() && ImGui::CollapsingHeader("Paging")) {
+		ImGui::Text("Resident pages: %d of %d (%.1f MB pool)", paged_map.residentCount(), paged_map.slotCount(), paged_map.poolBytes() / (1024.0f * 1024.0f));
+		ImGui::Text("Radius: %d pages", paged_map.radius());
+		ImGui::Text("Loads: %u, evictions: %u, failed: %u", paged_map.loads, paged_map.evictions, paged_map.failed.load());
+	}
+
+	if (world_loader.chunkCount() > 0 && !paged_map.active() && ImGui::CollapsingHeader("World")) {
+		ImGui::Text("Chunks: %u of %u, %u failed", world_loader.applied, world_loader.chunkCount(), world_loader.failed.load());
+		if (!world_loading) ImGui::Text("Loaded in %.0f ms", world_loader.load_ms);
+	}
+
+	if (animator.trackCount() > 0 && ImGui::CollapsingHeader("Animation")) {
+		ImGui::Checkbox("Play", &animator.playing);
+		ImGui::SliderFloat("Frames/Second", &animator.fps, 1.0f, 60.0f, "%.0f");
+		ImGui::Text("Frame %u, %u of %d tracks changed", animator.frame(), animator.changed, animator.trackCount());
+	}
+
+	if (ImGui::CollapsingHeader("G-Buffer")) {
+		bool changed = ImGui::Combo("Radiance", &target_pool.layout.radiance, gbuffer::kRadianceFormatNames, IM_ARRAYSIZE(gbuffer::kRadianceFormatNames));
+		changed |= ImGui::Combo("Depth", &target_pool.layout.depth, gbuffer::kDepthFormatNames, IM_ARRAYSIZE(gbuffer::kDepthFormatNames));
+
+		if (changed) { // reallocate targets
+			target_pool.clear();
+			curr_target = last_target = primary_target = last_primary_target = nullptr;
+		}
+
+		ImGui::Text("%u bytes/pixel", target_pool.layout.bytesPerPixel());
+		ImGui::Text("~%.1f MB/frame", target_pool.layout.bytesPerFrame(render_width, render_height, blur_size) / (1024.0 * 1024.0));
+	}
+
+	if (ImGui::CollapsingHeader("Primary Rays")) {
+		ImGui::Checkbox("Temporal AA", &taa_enabled);
+		if (taa_enabled) ImGui::SliderFloat("TAA History", &temporal_aa.max_history, 2.0f, 32.0f, "%.0f");
+		ImGui::Checkbox("Depth Prepass", &depth_prepass);
+		ImGui::Checkbox("Reuse Still Hits", &reuse_primary_hits);
+		ImGui::Text("Coarse depth: %dx%d", prepass_size.x, prepass_size.y);
+	}
+
+	if (ImGui::CollapsingHeader("Progressive")) {
+		ImGui::Checkbox("Accumulate When Still", &progressive_enabled);
+		ImGui::SliderInt("Target SPP", &progressive_target_spp, 16, 2048); // history is a half float, exact up to 2048
+		ImGui::SliderFloat("Target Error", &progressive_target_error, 0.0001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+
+		if (idle) ImGui::Text("Converged, idling");
+		else if (progressive_active) ImGui::Text("Accumulating: %u frames", progressive_frames);
+		else ImGui::Text("Camera moving");
+		if (progressive_active && error_estimate.mean_error >= 0.0f) ImGui::Text("Error: %.4f", error_estimate.mean_error);
+	}
+
+	if (ImGui::CollapsingHeader("Resolution")) {
+		ImGui::Combo("Upscaling", &upscale_mode, kUpscaleModeNames, IM_ARRAYSIZE(kUpscaleModeNames));
+		ImGui::Combo("Indirect Lighting", &indirect_downscale, kIndirectScaleNames, IM_ARRAYSIZE(kIndirectScaleNames));
+		ImGui::Checkbox("Dynamic Resolution", &resolution.enabled);
+		if (resolution.enabled) {
+			ImGui::SliderFloat("Target (ms)", &resolution.target_ms, 4.0f, 50.0f);
+			ImGui::SliderFloat("Min Scale", &resolution.min_scale, 0.25f, resolution.max_scale);
+			ImGui::SliderFloat("Max Scale", &resolution.max_scale, resolution.min_scale, 1.0f);
+		}
+		else {
+			ImGui::SliderFloat("Render Scale", &resolution.scale, 0.25f, 1.0f);
+		}
+
+		ImGui::Text("Render: %dx%d (%.0f%%)", render_width, render_height, resolution.scale * 100.0f);
+		ImGui::Text("GPU: %.2f ms", resolution.gpu_ms);
+		ImGui::Text("Pooled targets: %d", int(target_pool.size()));
+	}
+
+	if (ImGui::CollapsingHeader("Traversal Stats")) {
+		if (ImGui::Checkbox("Enabled", &target_pool.layout.traversal_stats)) { // reallocate targets with the extra attachment
+			target_pool.clear();
+			curr_target = last_target = primary_target = last_primary_target = nullptr;
+			requestTraceVariant();
+		}
+
+		if (target_pool.layout.traversal_stats) {
+			ImGui::Text("Steps: mean %.1f, p95 %u, max %u", traversal_stats.mean_steps, traversal_stats.p95_steps, traversal_stats.max_steps);
+			ImGui::Text("Rays: %llu (%.1f Mrays/s)", traversal_stats.total_rays, traversal_stats.total_rays / (glm::max(profiler.lastMs("primary") + profiler.lastMs("path trace"), 0.001f) * 1e3f));
+			ImGui::Text("Frame change: %.4f", convergence_stats.mean_change);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Shaders")) {
+		ImGui::Text("Parallel compile: %s", program_cache.parallelCompile() ? "yes" : "no");
+		ImGui::Text("Program binaries: %s", program_cache.programBinaries() ? "yes" : "no");
+		ImGui::Text("Cache: %u hits, %u misses", program_cache.cache_hits, program_cache.cache_misses);
+		ImGui::Text("Last build: %.1f ms", program_cache.last_build_ms);
+		if (pending_trace_variant != -1) ImGui::Text("Compiling...");
+	}
+
+	if (ImGui::CollapsingHeader("Profiler")) {
+		profiler.drawImGui();
+	}
+
 	ImGui::End();
 }
 
@@ -458,51 +902,123 @@ unsigned int createVAO() {
 	return VAO;
 }
 
-void draw(Shader shader, Shader post_shader, unsigned int vao) {
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo1);
-	glClear(GL_COLOR_BUFFER_BIT);
+void draw(Shader& shader, Shader& prepass_shader, Shader& blur_shader, Shader& post_shader, Shader& taa_shader, unsigned int vao) {
+	glm::ivec2 render_size = resolution.renderSize(window_width, window_height);
+	render_width = render_size.x;
+	render_height = render_size.y;
 
-	shader.use();
+	// indirect lighting is traced at a fraction of the render resolution, primary hits stay at full resolution
+	int indirect_scale = 1 << indirect_downscale;
+	glm::ivec2 indirect_size = glm::max(render_size / indirect_scale, glm::ivec2(1));
 
-	shader.setMat4("CamRotation", glm::mat4_cast(camera.GetRotation()));
-	shader.setVec3("CamPosition", camera.position);
+	// idle frames present the converged targets again
+	if (!idle) {
+		curr_target = target_pool.acquire(indirect_size.x, indirect_size.y, { last_target, last_primary_target }, frame_count);
 
-	shader.setMat4("LastCamRotation", glm::mat4_cast(last_camera.GetRotation()));
-	shader.setVec3("LastCamPosition", last_camera.position);
+		primary_target = curr_target;
+		if (indirect_scale > 1)
+			primary_target = target_pool.acquire(render_width, render_height, { last_target, last_primary_target, curr_target }, frame_count);
+	}
 
-	shader.setUVec2("Resolution", window_width, window_height);
+	// the debug outputs are shown as traced
+	bool taa = taa_enabled && selected_output <= 1;
+	if (taa) temporal_aa.resize(window_width, window_height);
+	else temporal_aa.invalidate();
+
+	// idle frames trace nothing new, a valid history is already the resolved frame
+	bool present_only = taa && idle && temporal_aa.historyValid();
+
+	glm::vec2 jitter = taa ? TemporalAA::jitter(frame_count) * 2.0f / glm::vec2(render_size) : glm::vec2(0.0f);
+
+	FrameData frame_data;
+	frame_data.cam_rotation = glm::mat4_cast(camera.GetRotation());
+	frame_data.last_cam_rotation = glm::mat4_cast(last_camera.GetRotation());
+	frame_data.cam_position = camera.position;
+	frame_data.last_cam_position = last_camera.position;
+	frame_data.render_resolution = render_size;
+	frame_data.frame_count = frame_count;
+	frame_data.upscale_mode = upscale_mode;
+	frame_data.indirect_scale = indirect_scale;
+	frame_data.jitter = jitter;
+	frame_data.last_jitter = last_jitter;
+	frame_ubo.update(&frame_data, sizeof(frame_data));
+
+	if (!idle) last_jitter = jitter;
+
+	if (!idle) {
+		// a still frame takes its first hits from the last one, the prepass is only needed when they change.
+		// jittered rays differ every frame, so there is nothing to reuse with the temporal anti-aliasing
+		bool reuse = reuse_primary_hits && progressive_active && !taa;
+		// the dilated map is only built once a streamed world finished loading, and not for a paged one
+		bool prepass = depth_prepass && !reuse && !world_loading && !paged_map.active();
+
+		if (prepass) {
+			profiler.beginGpu("prepass");
+			depthPrepass(prepass_shader, vao);
+			profiler.endGpu();
+		}
 
-	shader.setUInt("FrameCount", frame_count);
+		shader.use();
+		shader.setInt("BounceBudget", glm::min(bounce_budget, max_bounces));
+		shader.setInt("RouletteDepth", russian_roulette ? roulette_depth : max_bounces + 1);
+		shader.setBool("LightsEndPaths", lights_end_paths);
+		shader.setInt("LodBounce", lod_bounce);
+		shader.setFloat("LodPixels", lod_pixels);
+		shader.setBool("AdaptiveSampling", adaptive_sampling);
+		shader.setFloat("SampleBudget", sample_budget);
+		shader.setBool("Progressive", progressive_active);
+		shader.setBool("SampleSun", sun_sampling && brick_map->env_color == glm::vec3(-1));
+		shader.setBool("ReusePrimary", reuse);
+		shader.setBool("UseDepthPrepass", prepass);
+		shader.setInt("PrepassTile", kPrepassTile);
+		shader.setTexture("CoarseDepthTex", prepass_tex, kCoarseDepthSlot);
+
+		if (primary_target != curr_target) {
+			profiler.beginGpu("primary");
+			tracePass(shader, primary_target, true, last_primary_target, vao);
+			profiler.endGpu();
+		}
 
-	shader.setTexture("LastFrameTex", buffer_textures2[SCREEN_TEXTURE], 5 + SCREEN_TEXTURE);
-	shader.setTexture("HistoryTex", buffer_textures2[HISTORY_TEXTURE], 5 + HISTORY_TEXTURE);
-	shader.setTexture("LastDepthTex", buffer_textures2[DEPTH_TEXTURE], 5 + DEPTH_TEXTURE);
-	shader.setTexture("LastNormalTex", buffer_textures2[NORMAL_TEXTURE], 5 + NORMAL_TEXTURE);
+		profiler.beginGpu("path trace");
+		tracePass(shader, curr_target, false, last_target, vao);
 
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		// the top level of the moments averages the sampling need (and the error) for the next frame
+		if (adaptive_sampling || progressive_active) {
+			glActiveTexture(GL_TEXTURE0 + kBufferTextureSlot + MOMENTS_TEXTURE);
+			glBindTexture(GL_TEXTURE_2D, curr_target->textures[MOMENTS_TEXTURE]);
+			glGenerateMipmap(GL_TEXTURE_2D);
 
-	// post processing
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	post_shader.use();
+			if (progressive_active) error_estimate.update(curr_target);
+		}
+		profiler.endGpu();
+	}
 
-	post_shader.setUVec2("Resolution", window_width, window_height);
-	post_shader.setInt("OutputNum", selected_output);
-	post_shader.setFloat("Gamma", gamma);
-	post_shader.setInt("BlurSize", blur_size);
+	if (!present_only) {
+		profiler.beginGpu("blur");
+		illumination_blur.blur(blur_shader, curr_target, blur_size, indirect_scale, vao);
+		profiler.endGpu();
 
-	post_shader.setTexture("Texture", buffer_textures1[SCREEN_TEXTURE], 5 + SCREEN_TEXTURE);
-	post_shader.setTexture("AlbedoTex", buffer_textures1[ALBEDO_TEXTURE], 5 + ALBEDO_TEXTURE);
-	post_shader.setTexture("EmissionTex", buffer_textures1[EMISSION_TEXTURE], 5 + EMISSION_TEXTURE);
-	post_shader.setTexture("NormalTex", buffer_textures1[NORMAL_TEXTURE], 5 + NORMAL_TEXTURE);
-	post_shader.setTexture("DepthTex", buffer_textures1[DEPTH_TEXTURE], 5 + DEPTH_TEXTURE);
-	post_shader.setTexture("HistoryTex", buffer_textures1[HISTORY_TEXTURE], 5 + HISTORY_TEXTURE);
+		profiler.beginGpu("post");
+		postProcess(post_shader, taa ? temporal_aa.inputFbo() : 0, vao);
+		profiler.endGpu();
 
-	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+		if (taa) {
+			profiler.beginGpu("taa");
+			temporal_aa.resolve(taa_shader, primary_target, progressive_active, vao);
+			profiler.endGpu();
+		}
+	}
+	if (taa) temporal_aa.present();
+
+	if (target_pool.layout.traversal_stats && !idle) {
+		traversal_stats.update(curr_target);
+		convergence_stats.update(curr_target);
+	}
 
 	// selected highlight outline
-	drawUtils::passDepthTexture(buffer_textures1[DEPTH_TEXTURE], 5 + DEPTH_TEXTURE);
+	glViewport(0, 0, window_width, window_height);
+	drawUtils::passResolution(render_width, render_height);
+	drawUtils::passDepthTexture(primary_target->textures[DEPTH_TEXTURE], kBufferTextureSlot + DEPTH_TEXTURE);
 
 	drawUtils::line_color = kSelectedLineColor;
 	drawSelectedBrickLines();
@@ -512,10 +1028,108 @@ void draw(Shader shader, Shader post_shader, unsigned int vao) {
 	drawUtils::drawLine(glm::vec2(-kCrosshairSize * window_height / window_width, 0.), glm::vec2(kCrosshairSize * window_height / window_width, 0.));
 	drawUtils::drawLine(glm::vec2(0., -kCrosshairSize), glm::vec2(0., kCrosshairSize));
 
+	profiler.beginGpu("debug lines");
 	drawUtils::drawLinesFlush();
+	profiler.endGpu();
 }
 
-bool loadScene(Shader shader, const std::string scene_path, unsigned int* scene_texture, unsigned int* bricks_texture, unsigned int* mats_texture) {
+// composes the render targets and upscales them to the window, into 'fbo'
+void postProcess(Shader& post_shader, unsigned int fbo, unsigned int vao) {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, window_width, window_height);
+	post_shader.use();
+
+	post_shader.setInt("OutputNum", selected_output);
+	post_shader.setFloat("Gamma", gamma);
+
+	post_shader.setTexture("Texture", illumination_blur.texture(), kBufferTextureSlot + SCREEN_TEXTURE);
+	post_shader.setTexture("IllumNormalTex", curr_target->textures[NORMAL_TEXTURE], kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 0);
+	post_shader.setTexture("IllumDepthTex", curr_target->textures[DEPTH_TEXTURE], kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 1);
+	post_shader.setTexture("IllumHistoryTex", curr_target->textures[HISTORY_EMISSION_TEXTURE], kBufferTextureSlot + BUFFER_TEXTURE_COUNT + 2);
+	post_shader.setTexture("MomentsTex", curr_target->textures[MOMENTS_TEXTURE], kBufferTextureSlot + MOMENTS_TEXTURE);
+	post_shader.setTexture("TraversalTex", curr_target->textures[TRAVERSAL_TEXTURE], kBufferTextureSlot + TRAVERSAL_TEXTURE);
+	post_shader.setFloat("TraversalScale", float(glm::max(traversal_stats.p95_steps * 2u, 64u)));
+
+	post_shader.setTexture("AlbedoTex", primary_target->textures[ALBEDO_TEXTURE], kBufferTextureSlot + ALBEDO_TEXTURE);
+	post_shader.setTexture("NormalTex", primary_target->textures[NORMAL_TEXTURE], kBufferTextureSlot + NORMAL_TEXTURE);
+	post_shader.setTexture("DepthTex", primary_target->textures[DEPTH_TEXTURE], kBufferTextureSlot + DEPTH_TEXTURE);
+	post_shader.setTexture("HistoryEmissionTex", primary_target->textures[HISTORY_EMISSION_TEXTURE], kBufferTextureSlot + HISTORY_EMISSION_TEXTURE);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+// runs the path tracing shader into a target. primary_only passes only resolve the first hit
+// (depth, normal, albedo, emission), the lighting and its history come from the full pass.
+// 'last' is the previous frame's target of the same pass
+void tracePass(Shader& shader, gbuffer::RenderTarget* target, bool primary_only, const gbuffer::RenderTarget* last, unsigned int vao) {
+	glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+	glViewport(0, 0, target->width, target->height);
+
+	unsigned int draw_buffers[BUFFER_TEXTURE_COUNT];
+	std::copy(std::begin(target->draw_buffers), std::end(target->draw_buffers), draw_buffers);
+	if (primary_only) draw_buffers[SCREEN_TEXTURE] = GL_NONE;
+	glDrawBuffers(BUFFER_TEXTURE_COUNT, draw_buffers);
+
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	shader.setUVec2("Resolution", target->width, target->height);
+	shader.setBool("PrimaryOnly", primary_only);
+
+	// without a last frame (first frame or the layout changed) the unbound textures read as empty history
+	unsigned int last_textures[BUFFER_TEXTURE_COUNT] = { 0 };
+	if (last) std::copy(std::begin(last->textures), std::end(last->textures), last_textures);
+
+	shader.setTexture("LastFrameTex", last_textures[SCREEN_TEXTURE], kBufferTextureSlot + SCREEN_TEXTURE);
+	shader.setTexture("HistoryTex", last_textures[HISTORY_EMISSION_TEXTURE], kBufferTextureSlot + HISTORY_EMISSION_TEXTURE);
+	shader.setTexture("LastDepthTex", last_textures[DEPTH_TEXTURE], kBufferTextureSlot + DEPTH_TEXTURE);
+	shader.setTexture("LastNormalTex", last_textures[NORMAL_TEXTURE], kBufferTextureSlot + NORMAL_TEXTURE);
+	shader.setTexture("LastMomentsTex", last_textures[MOMENTS_TEXTURE], kBufferTextureSlot + MOMENTS_TEXTURE);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+// conservative distance the primary rays of every kPrepassTile^2 pixel tile can skip, see CoarseDistance in the shader
+void depthPrepass(Shader& shader, unsigned int vao) {
+	glm::ivec2 size = (glm::ivec2(render_width, render_height) + kPrepassTile - 1) / kPrepassTile;
+
+	if (size != prepass_size) {
+		if (!prepass_fbo) glGenFramebuffers(1, &prepass_fbo);
+		if (!prepass_tex) glGenTextures(1, &prepass_tex);
+
+		glActiveTexture(GL_TEXTURE0 + kCoarseDepthSlot);
+		glBindTexture(GL_TEXTURE_2D, prepass_tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size.x, size.y, 0, GL_RED, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, prepass_fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, prepass_tex, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+
+		prepass_size = size;
+	}
+
+	// angle between a tile's center ray and its corner rays (the near plane is at 1.5, 2 units high), plus up to
+	// half a pixel of jitter. the skip is only conservative while every ray of the tile stays within a brick of the center ray
+	float tile_angle = glm::sqrt(2.0f) * (kPrepassTile + 1) / (1.5f * render_height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, prepass_fbo);
+	glViewport(0, 0, size.x, size.y);
+
+	shader.use();
+	shader.setInt("PrepassTile", kPrepassTile);
+	shader.setFloat("MaxSkip", 0.9f / tile_angle);
+
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+}
+
+bool loadScene(const std::string scene_path, unsigned int* scene_texture, unsigned int* bricks_texture, unsigned int* mats_texture) {
 	std::ifstream scene_file(kAssetsFolder + scene_path);
 
 	if (!scene_file) {
@@ -523,11 +1137,91 @@ bool loadScene(Shader shader, const std::string scene_path, unsigned int* scene_
 		return false;
 	}
 
-	// map
+	// map, or 'brickify <model>' to split a full resolution model into its own bricks
 	std::string brickmap_path;
 	scene_file >> brickmap_path;
-	brick_map = std::unique_ptr<BrickMap>(new BrickMap((kAssetsFolder + brickmap_path).c_str()));
-	if (brick_map->data.empty()) return false; // failed to load brickmap
+	if (brickmap_path == "brickify") {
+		scene_file >> brickmap_path;
+
+		Brickifier brickifier;
+		if (!brickifier.import((kAssetsFolder + brickmap_path).c_str())) return false;
+
+		std::cout << "Brickified \'" << brickmap_path << "\' in " << brickifier.import_ms << " ms: " << brickifier.filled_cells << " cells, "
+			<< brickifier.unique_bricks << " unique bricks.\n";
+
+		brick_map = std::move(brickifier.map);
+		bricks = std::move(brickifier.bricks);
+	}
+	// or 'minecraft <region file or folder> <block table> <min y> <height>' to stream a world's chunks
+	else if (brickmap_path == "minecraft") {
+		std::string blocks_path;
+		int min_y, height;
+		if (!(scene_file >> brickmap_path >> blocks_path >> min_y >> height) || height <= 0) {
+			std::cout << "Minecraft world is invalid. Expected regions, a block table, the lowest block and the height.\n";
+			return false;
+		}
+
+		minecraft::BlockTable blocks;
+		if (!blocks.load((kAssetsFolder + blocks_path).c_str())) return false;
+
+		glm::ivec3 map_size;
+		if (!world_loader.open(kAssetsFolder + brickmap_path, blocks, min_y, height, &map_size)) return false;
+		world_loader.start();
+		world_loading = true;
+
+		brick_map = std::unique_ptr<BrickMap>(new BrickMap(map_size));
+		brick_map->camera = minecraft::overviewCamera(brick_map->size);
+	}
+	// or 'paged <region file or folder> <block table> <min y> <height> <radius>' to keep only the chunks within radius
+	// chunks of the camera
+	else if (brickmap_path == "paged") {
+		std::string blocks_path;
+		int min_y, height, radius;
+		if (!(scene_file >> brickmap_path >> blocks_path >> min_y >> height >> radius) || height <= 0 || radius < 0) {
+			std::cout << "Paged world is invalid. Expected regions, a block table, the lowest block, the height and the radius.\n";
+			return false;
+		}
+
+		minecraft::BlockTable blocks;
+		if (!blocks.load((kAssetsFolder + blocks_path).c_str())) return false;
+
+		glm::ivec3 map_size;
+		if (!world_loader.open(kAssetsFolder + brickmap_path, blocks, min_y, height, &map_size)) return false;
+
+		// the loader's chunks are the pages
+		auto load_page = [](const glm::ivec2& page, std::vector<uint32_t>* words) { return world_loader.readChunk(page, words); };
+		if (!paged_map.create(map_size, radius, load_page, 0, kPageTableSlot)) return false;
+
+		brick_map = std::unique_ptr<BrickMap>(new BrickMap(map_size, false));
+		brick_map->camera = minecraft::overviewCamera(brick_map->size);
+	}
+	// or 'schematic <file.schem> <block table>' for a Sponge schematic
+	else if (brickmap_path == "schematic") {
+		std::string blocks_path;
+		if (!(scene_file >> brickmap_path >> blocks_path)) {
+			std::cout << "Schematic is invalid. Expected a schematic file and a block table.\n";
+			return false;
+		}
+
+		minecraft::BlockTable blocks;
+		if (!blocks.load((kAssetsFolder + blocks_path).c_str())) return false;
+
+		brick_map = minecraft::readSchematic((kAssetsFolder + brickmap_path).c_str(), blocks);
+		if (!brick_map) return false;
+	}
+	else {
+		brick_map = std::unique_ptr<BrickMap>(new BrickMap((kAssetsFolder + brickmap_path).c_str()));
+		if (brick_map->data.empty()) return false; // failed to load brickmap
+	}
+
+	// the map texture holds an x row of packed columns per z, stitched worlds can outgrow it. a paged map only has
+	// the pool and the page table on the gpu, PagedMap::create checked those
+	int max_texture_size;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	if (!paged_map.active() && (brick_map->size.x * brick_map->size.y / MAP_CELLS_PER_WORD > max_texture_size || brick_map->size.z > max_texture_size)) {
+		std::cout << "Brickmap \'" << brickmap_path << "\' is too large (" << brick_map->size.x << "x" << brick_map->size.y << "x" << brick_map->size.z << ").\n";
+		return false;
+	}
 
 	std::string sky_setting;
 	scene_file >> sky_setting;
@@ -538,47 +1232,100 @@ bool loadScene(Shader shader, const std::string scene_path, unsigned int* scene_
 		return false;
 	}
 
+	// bricks, mixed with instanced models: 'instance <model> x y z [rotation x y z [scale]]' and animated
+	// MagicaVoxel scenes: 'animation <scene> x y z [scale]', one per line
 	std::vector<std::string> brick_paths;
-	std::string next_brick_path;
-	while (scene_file >> next_brick_path)
-		brick_paths.push_back(next_brick_path);
+	std::map<std::string, int> model_indices;
+	std::string token;
+	while (scene_file >> token) {
+		if (token == "animation") {
+			std::string line;
+			std::getline(scene_file, line);
+			std::istringstream animation_line(line);
+
+			std::string animation_path;
+			glm::vec3 position;
+			float scale = 1.0f;
+			if (!(animation_line >> animation_path >> position.x >> position.y >> position.z)) {
+				std::cout << "Animation \'" << line << "\' is invalid. Expected a scene and a position.\n";
+				return false;
+			}
+			if (!(animation_line >> scale)) scale = 1.0f;
+
+			if (!animator.load((kAssetsFolder + animation_path).c_str(), instances, position, scale)) return false;
+			continue;
+		}
 
-	shader.use();
-	shader.setUVec3("MapSize", brick_map->size.x, brick_map->size.y, brick_map->size.z);
+		if (token != "instance") {
+			brick_paths.push_back(token);
+			continue;
+		}
 
-	glGenTextures(1, scene_texture);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, *scene_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, brick_map->size.x * brick_map->size.y / 8, brick_map->size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, brick_map->data.data());
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		std::string line;
+		std::getline(scene_file, line);
+		std::istringstream instance_line(line);
+
+		std::string model_path;
+		instancing::Instance instance;
+		if (!(instance_line >> model_path >> instance.position.x >> instance.position.y >> instance.position.z)) {
+			std::cout << "Instance '" << line << "' is invalid. Expected a model and a position.\n";
+			return false;
+		}
+
+		glm::vec3 rotation;
+		float scale;
+		if (instance_line >> rotation.x >> rotation.y >> rotation.z) instance.rotation = rotation;
+		if (instance_line >> scale) instance.scale = scale;
+
+		// every instance of a model shares its voxels
+		if (model_indices.find(model_path) == model_indices.end()) {
+			VoxelModel model((kAssetsFolder + model_path).c_str());
+			if (model.data.empty()) return false; // failed to load model
+			model_indices[model_path] = instances.addModel(model);
+		}
+		instance.model = model_indices[model_path];
+		instances.addInstance(instance);
+	}
 
-	glUniform1i(glGetUniformLocation(shader.ID, "BrickMap"), 0);
+	if (!paged_map.active()) {
+		glGenTextures(1, scene_texture);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, *scene_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, brick_map->size.x * brick_map->size.y / MAP_CELLS_PER_WORD, brick_map->size.z, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, brick_map->data.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
 
 	// bricks
+	if (!bricks.empty() && !brick_paths.empty()) {
+		std::cout << "A brickified map brings its own bricks, the listed ones can't be added.\n";
+		return false;
+	}
+
+	for (const std::string& brick_path : brick_paths) {
+		bricks.push_back(std::unique_ptr<Brick>(new Brick((kAssetsFolder + brick_path).c_str())));
+		if (bricks.back()->data.empty()) return false; // failed to load brick
+	}
+
 	glGenTextures(1, bricks_texture);
 	glActiveTexture(GL_TEXTURE0 + 1);
 	glBindTexture(GL_TEXTURE_2D_ARRAY, *bricks_texture);
 
 	// allocate bricks texture array
-	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32UI, BRICK_SIZE * BRICK_SIZE / 8, BRICK_SIZE, brick_paths.size(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32UI, BRICK_SIZE * BRICK_SIZE / 8, BRICK_SIZE, bricks.size(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
 
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
-	std::vector<uint32_t> mats_data(brick_paths.size() * 16 * 2);
+	std::vector<uint32_t> mats_data(bricks.size() * 16 * 2);
 
-	for (int i = 0; i < brick_paths.size(); i++)
+	for (int i = 0; i < bricks.size(); i++)
 	{
-		bricks.push_back(std::unique_ptr<Brick>(new Brick((kAssetsFolder + brick_paths[i]).c_str())));
-
-		Brick* brick = bricks.back().get();
-
-		if (brick->data.empty()) return false; // failed to load brick
+		Brick* brick = bricks[i].get();
 
 		// assign brick data
 		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, BRICK_SIZE * BRICK_SIZE / 8, BRICK_SIZE, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, brick->data.data());
@@ -586,38 +1333,163 @@ bool loadScene(Shader shader, const std::string scene_path, unsigned int* scene_
 		for (int j = 1; j < brick->mats.size(); j++) // load all brick's materials
 		{
 			mats_data[(i * 16 + j) * 2 + 0] = brick->mats[j].color | (brick->mats[j].roughness << 24);
-			mats_data[(i * 16 + j) * 2 + 1] = brick->mats[j].emission;
+			mats_data[(i * 16 + j) * 2 + 1] = brick->mats[j].emission | (brick->mats[j].max_depth << 16);
 		}
 	}
 
-	glUniform1i(glGetUniformLocation(shader.ID, "BricksTex"), 1);
-
 	// materials
 	glGenTextures(1, mats_texture);
 	glActiveTexture(GL_TEXTURE0 + 2);
 	glBindTexture(GL_TEXTURE_2D, *mats_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, 16, brick_paths.size(), 0, GL_RG_INTEGER, GL_UNSIGNED_INT, mats_data.data());
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, 16, bricks.size(), 0, GL_RG_INTEGER, GL_UNSIGNED_INT, mats_data.data());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
-	glUniform1i(glGetUniformLocation(shader.ID, "MatsTex"), 2);
+	// coarse bricks, a row each
+	std::vector<uint32_t> lod_data;
+	for (const std::unique_ptr<Brick>& brick : bricks) {
+		std::vector<uint32_t> words = brick->lodData();
+		lod_data.insert(lod_data.end(), words.begin(), words.end());
+	}
 
-	shader.setVec3("EnvironmentColor", brick_map->env_color);
+	glGenTextures(1, &brick_lod_tex);
+	glActiveTexture(GL_TEXTURE0 + kBrickLodSlot);
+	glBindTexture(GL_TEXTURE_2D, brick_lod_tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, BRICK_LOD_SIZE * BRICK_LOD_SIZE * BRICK_LOD_SIZE / 8, bricks.size(), 0, GL_RED_INTEGER, GL_UNSIGNED_INT, lod_data.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	uploadDilatedMap();
 
 	camera = brick_map->camera;
+	simulated_position = previous_simulated_position = camera.position;
+	simulation_time = 0.0f;
 
 	return true;
 }
 
+// switches to progressive accumulation once nothing changed for a frame, and stops tracing when it converged
+void updateProgressive() {
+	TraceState state = {
+		camera.position, camera.yaw, camera.pitch, scene_version, window_width, window_height, resolution.scale,
+		trace_variant, bounce_budget, roulette_depth, upscale_mode, indirect_downscale, lod_bounce, russian_roulette, adaptive_sampling, lights_end_paths, sun_sampling, sample_budget, lod_pixels
+	};
+	bool still = state == last_trace_state && curr_target && !benchmark.isRunning();
+	last_trace_state = state;
+
+	if (!progressive_enabled || !still) {
+		progressive_active = idle = false;
+		progressive_frames = 0;
+		error_estimate.reset();
+		return;
+	}
+
+	progressive_active = true;
+	if (!idle) progressive_frames++;
+
+	// paths per pixel so far, the upscaling modes trace a pixel every 2 or 4 frames
+	float traced_fraction = upscale_mode == 0 ? 1.0f : upscale_mode == 1 ? 0.5f : 0.25f;
+	float paths_per_frame = (adaptive_sampling ? sample_budget : 1.0f) * traced_fraction;
+	bool reached_spp = progressive_frames * paths_per_frame >= progressive_target_spp;
+	bool reached_error = error_estimate.mean_error >= 0.0f && error_estimate.mean_error < progressive_target_error;
+
+	// checked while idle too, raising the targets in the UI resumes the accumulation
+	idle = reached_spp || reached_error;
+}
+
+// scene bindings of the path tracing program, set again whenever a new permutation is swapped in
+void setSceneUniforms(Shader& shader) {
+	shader.use();
+	shader.setUVec3("MapSize", brick_map->size.x, brick_map->size.y, brick_map->size.z);
+	shader.setInt("BrickMap", 0);
+	shader.setBool("PagedMap", paged_map.active());
+	shader.setInt("PageTable", kPageTableSlot);
+	shader.setInt("PoolColumns", paged_map.poolColumns());
+	shader.setInt("BricksTex", 1);
+	shader.setInt("MatsTex", 2);
+	shader.setInt("BrickLodTex", kBrickLodSlot);
+	shader.setInt("BlueNoiseTex", kBlueNoiseSlot);
+	shader.setInt("DilatedMapTex", kDilatedMapSlot);
+	shader.setVec3("EnvironmentColor", brick_map->env_color);
+
+	shader.setInt("SkyLut", kSkyLutSlot);
+	shader.setVec3("SunDirection", sky_params.sunDirection());
+	shader.setVec3("SunColor", sky_params.sunRadiance());
+	shader.setFloat("SunExponent", sky_params.sun_exponent);
+
+	shader.setInt("InstancesTex", kInstancesSlot);
+	shader.setInt("ModelsTex", kModelsSlot);
+	shader.setInt("InstanceCount", instances.count());
+	shader.setInt("InstanceBase", instances.instanceBase());
+}
+
+// bakes the sky again after its parameters changed
+void updateSky() {
+	sky::bakeLut(sky_lut_tex, kSkyLutWidth, kSkyLutHeight, kSkyLutSlot, sky_params);
+	setSceneUniforms(*trace_shader);
+	scene_version++;
+}
+
+// applies the chunks the world loader finished, the dilated map follows once all are in
+void updateWorldLoading() {
+	if (!world_loading) return;
+	Profiler::CpuScope scope(profiler, "world");
+
+	if (world_loader.update(*brick_map, scene_tex) > 0) scene_version++;
+	if (world_loader.loading()) return;
+
+	world_loading = false;
+	uploadDilatedMap();
+	std::cout << "Loaded " << world_loader.chunkCount() - world_loader.failed << " chunks in " << world_loader.load_ms << " ms, " << world_loader.failed << " failed.\n";
+}
+
+// pages the world in around the camera
+void updatePaging() {
+	if (!paged_map.active()) return;
+	Profiler::CpuScope scope(profiler, "paging");
+
+	if (paged_map.update(camera.position)) scene_version++;
+}
+
+// refits the instances' top-level BVH after they moved, the still frame accumulation starts over
+void updateInstances() {
+	Profiler::CpuScope scope(profiler, "instances");
+
+	animator.update(animation_time, instances);
+
+	if (!instances.update(kInstancesSlot, kModelsSlot)) return;
+	setSceneUniforms(*trace_shader);
+	scene_version++;
+}
+
+// compile time options of the path tracing program, every distinct set is its own cached permutation
+ShaderDefines traceDefines() {
+	ShaderDefines defines;
+	defines["BRICK_RES"] = std::to_string(BRICK_SIZE);
+	defines["LOD_RES"] = std::to_string(BRICK_LOD_SIZE);
+	defines["MAP_CELL_BITS"] = std::to_string(MAP_CELL_BITS);
+	defines["MAX_BOUNCES"] = std::to_string(max_bounces);
+	defines["SAMPLER"] = std::to_string(sampler_type);
+	defines["TRAVERSAL_STATS"] = target_pool.layout.traversal_stats ? "1" : "0";
+	return defines;
+}
+
+void requestTraceVariant() {
+	pending_trace_variant = program_cache.request("src/vertex.vert", "src/fragment.frag", traceDefines());
+	if (pending_trace_variant == trace_variant) pending_trace_variant = -1;
+}
+
 bool isPositionOccupied(const glm::vec3 pos) {
 	if (pos.x < 0.0f || pos.x >= brick_map->size.x || pos.y < 0.0f || pos.y >= brick_map->size.y || pos.z < 0.0f || pos.z >= brick_map->size.z)
 		return false;
 
-	unsigned int brick_ID = brick_map->getVoxel(pos.x, pos.y, pos.z);
+	unsigned int brick_ID = paged_map.active() ? paged_map.getVoxel(pos.x, pos.y, pos.z) : brick_map->getVoxel(pos.x, pos.y, pos.z);
 
-	if (brick_ID == 0) return false; // air
+	if (brick_ID == 0 || brick_ID > bricks.size()) return false; // air, or a cell without a brick
 
 	glm::ivec3 in_brick_pos = glm::ivec3(pos * float(BRICK_SIZE)) % BRICK_SIZE;
 	unsigned int voxel_mat = bricks[brick_ID - 1]->getVoxel(in_brick_pos.x, in_brick_pos.y, in_brick_pos.z);
@@ -625,6 +1497,58 @@ bool isPositionOccupied(const glm::vec3 pos) {
 	return voxel_mat != 0;
 }
 
+// times the swept box collider against the old ray cast mover on the same random moves through the scene
+void runCollisionBenchmark() {
+	const int kMoves = 20000;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	glm::vec3 map_extent = glm::vec3(brick_map->size);
+
+	struct Move { glm::vec3 start, dir; float amount; };
+	std::vector<Move> moves;
+	while (moves.size() < kMoves) {
+		glm::vec3 start = glm::vec3(unit(rng), unit(rng), unit(rng)) * map_extent;
+		if (isPositionOccupied(start)) continue;
+
+		glm::vec3 dir = glm::vec3(unit(rng), unit(rng), unit(rng)) * 2.0f - 1.0f;
+		if (glm::length(dir) < 0.01f) continue;
+		moves.push_back({ start, dir, 0.01f + 0.3f * unit(rng) });
+	}
+
+	Camera body_camera = camera;
+	body_camera.no_clip = false;
+	body_camera.step_height = 0.0f; // the ray cast mover can't step up, compare the same motion
+
+	std::vector<glm::vec3> ray_cast_ends(kMoves);
+	auto start_time = std::chrono::steady_clock::now();
+	for (int i = 0; i < kMoves; i++) {
+		body_camera.position = moves[i].start;
+		body_camera.MoveRayCast(moves[i].dir, moves[i].amount, &isPositionOccupied, brick_map->size * BRICK_SIZE);
+		ray_cast_ends[i] = body_camera.position;
+	}
+	double ray_cast_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count() / kMoves;
+
+	std::vector<glm::vec3> swept_ends(kMoves);
+	collider.voxels_tested = 0;
+	start_time = std::chrono::steady_clock::now();
+	for (int i = 0; i < kMoves; i++) {
+		body_camera.position = moves[i].start;
+		body_camera.Move(moves[i].dir, moves[i].amount, collider);
+		swept_ends[i] = body_camera.position;
+	}
+	double swept_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_time).count() / kMoves;
+
+	double difference_sum = 0.0;
+	for (int i = 0; i < kMoves; i++) difference_sum += glm::distance(swept_ends[i], ray_cast_ends[i]);
+
+	std::cout << "collision benchmark: " << kMoves << " random moves\n"
+		<< "ray cast: " << ray_cast_us << " us/move\n"
+		<< "swept aabb: " << swept_us << " us/move, " << double(collider.voxels_tested) / kMoves << " voxels/move ("
+		<< ray_cast_us / swept_us << "x)\n"
+		<< "mean end position difference: " << difference_sum / kMoves << std::endl;
+}
+
 void drawSelectedBrickLines() {
 	if (selected_brick == glm::ivec3(-1)) return;
 
@@ -0,0 +1,548 @@
+#ifndef MINECRAFT_H
+#define MINECRAFT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <climits>
+#include <cstdio>
+#include <io.h>
+#include "brick.h"
+#include "nbt.h"
+
+namespace minecraft {
+	// block state names to the scene's bricks, read from a text file of 'name brick' lines. a name without a
+	// namespace is in minecraft's, 'default brick' is used for the blocks that aren't listed (empty if it isn't
+	// given) and air is always empty. the block's properties are ignored
+	class BlockTable
+	{
+	public:
+		bool load(const char* file_path) {
+			std::ifstream file(file_path);
+			if (!file) {
+				std::cerr << "cannot open file " << file_path << std::endl;
+				return false;
+			}
+
+			std::string line;
+			while (std::getline(file, line)) {
+				if (line.empty() || line[0] == '#') continue;
+
+				std::istringstream entry(line);
+				std::string name;
+				int brick;
+				if (!(entry >> name)) continue;
+				if (!(entry >> brick) || brick < 0 || brick >= (1 << MAP_CELL_BITS)) {
+					std::cerr << file_path << ": '" << line << "' is invalid, expected a block and a brick from 0 to " << (1 << MAP_CELL_BITS) - 1 << "." << std::endl;
+					return false;
+				}
+
+				if (name == "default") default_ = uint8_t(brick);
+				else bricks_[qualified_(name)] = uint8_t(brick);
+			}
+
+			for (const char* air : { "minecraft:air", "minecraft:cave_air", "minecraft:void_air" }) bricks_[air] = 0;
+			return true;
+		}
+
+		uint8_t brick(const std::string& name) const {
+			auto it = bricks_.find(qualified_(name));
+			return it != bricks_.end() ? it->second : default_;
+		}
+
+	private:
+		std::unordered_map<std::string, uint8_t> bricks_;
+		uint8_t default_ = 0;
+
+		static std::string qualified_(const std::string& name) {
+			return name.find(':') == std::string::npos ? "minecraft:" + name : name;
+		}
+	};
+
+	// above the middle of a world, looking down on it
+	Camera overviewCamera(const glm::ivec3& map_size) {
+		return Camera(glm::vec3(map_size.x / 2.0f, map_size.y, map_size.z / 2.0f), { {0.0f},{1.0f},{0.0f} }, 0.0f, -30.0f);
+	}
+
+	// bricks of the palette entries of a section's block states
+	std::vector<uint8_t> paletteBricks(const nbt::Tag& palette, const BlockTable& table) {
+		std::vector<uint8_t> bricks(palette.list.size(), 0);
+		for (size_t i = 0; i < palette.list.size(); i++) {
+			const nbt::Tag* name = palette.list[i].get("Name", nbt::TAG_STRING);
+			if (name) bricks[i] = table.brick(name->string);
+		}
+		return bricks;
+	}
+
+	// Streams the chunks of Anvil region files (.mca) into a brick map, one block per brick. Worker threads read,
+	// inflate and parse the chunks and decode their sections straight into packed map columns, the main thread
+	// copies finished chunks into the map and uploads them as they come in, so the world fills in while it renders.
+	// Chunks from 1.13 on are read, both the 1.18 'sections' and the older 'Level' layout
+	class WorldLoader
+	{
+	public:
+		static const int kChunkSize = 16;
+		static const int kMaxChunksPerUpdate = 64; // applied per frame, bounds the upload hitch
+
+		// applied to the map so far, failed chunks count as applied. load_ms is the time it took to apply all
+		unsigned int applied = 0;
+		std::atomic<unsigned int> failed{ 0 };
+		float load_ms = 0.0f;
+
+		~WorldLoader() {
+			stop();
+		}
+
+		// a region file or a folder of them. finds the chunks in the region headers and sizes the map to their
+		// bounds and the height range of blocks from min_y. start() loads all of them, or readChunk() one at a time
+		bool open(const std::string& path, const BlockTable& table, int min_y, int height, glm::ivec3* map_size) {
+			stop();
+			table_ = table;
+			min_y_ = min_y;
+			height_ = (height + 7) / 8 * 8;
+
+			std::vector<std::string> files;
+			if (path.size() > 4 && path.compare(path.size() - 4, 4, ".mca") == 0) files.push_back(path);
+			else {
+				_finddata_t found;
+				intptr_t handle = _findfirst((path + "/*.mca").c_str(), &found);
+				if (handle != -1) {
+					do files.push_back(path + "/" + found.name);
+					while (_findnext(handle, &found) == 0);
+					_findclose(handle);
+				}
+			}
+
+			for (const std::string& file : files)
+				if (!readHeader_(file)) return false;
+
+			if (jobs_.empty()) {
+				std::cerr << path << ": no region chunks found." << std::endl;
+				return false;
+			}
+
+			glm::ivec2 min_chunk(INT_MAX), max_chunk(INT_MIN);
+			for (const Job_& job : jobs_) {
+				min_chunk = glm::min(min_chunk, job.chunk);
+				max_chunk = glm::max(max_chunk, job.chunk);
+			}
+
+			min_chunk_ = min_chunk;
+			chunks_ = max_chunk - min_chunk + 1;
+			*map_size = glm::ivec3(chunks_.x * kChunkSize, height_, chunks_.y * kChunkSize);
+
+			chunk_jobs_.assign(size_t(chunks_.x) * chunks_.y, -1);
+			for (size_t i = 0; i < jobs_.size(); i++) {
+				glm::ivec2 chunk = jobs_[i].chunk - min_chunk_;
+				chunk_jobs_[size_t(chunk.y) * chunks_.x + chunk.x] = int(i);
+			}
+
+			return true;
+		}
+
+		// streams every chunk into the map on all cores, see update()
+		void start() {
+			start_time_ = std::chrono::high_resolution_clock::now();
+			next_job_ = 0;
+			failed = 0;
+			failed_since_update_ = 0;
+			quit_ = false;
+
+			int thread_count = (int)std::max(1u, std::thread::hardware_concurrency());
+			for (int t = 0; t < thread_count; t++) workers_.emplace_back(&WorldLoader::work_, this);
+		}
+
+		// the packed columns of one chunk, in map chunks from the corner (see paging.h). missing chunks are empty.
+		// can be called from any thread
+		bool readChunk(const glm::ivec2& chunk, std::vector<uint32_t>* words) {
+			words->assign(kChunkSize * kChunkSize * height_ / MAP_CELLS_PER_WORD, 0);
+			if (glm::any(glm::lessThan(chunk, glm::ivec2(0))) || glm::any(glm::greaterThanEqual(chunk, chunks_))) return true;
+
+			int job = chunk_jobs_[size_t(chunk.y) * chunks_.x + chunk.x];
+			if (job < 0) return true;
+
+			std::vector<FILE*> files(regions_.size(), nullptr);
+			std::vector<uint8_t> compressed, inflated;
+			Chunk_ decoded = { jobs_[job].chunk, std::move(*words) };
+			bool loaded = readChunk_(jobs_[job], files, &compressed, &inflated) && decode_(inflated, &decoded);
+			for (FILE* file : files) if (file) fclose(file);
+
+			*words = std::move(decoded.words);
+			return loaded;
+		}
+
+		bool loading() const {
+			return applied < (unsigned int)jobs_.size();
+		}
+
+		unsigned int chunkCount() const {
+			return (unsigned int)jobs_.size();
+		}
+
+		// copies finished chunks into the map and uploads them to its texture (bound to unit 0), returns how many
+		// were applied
+		int update(BrickMap& map, unsigned int map_texture) {
+			std::vector<Chunk_> finished;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				size_t count = std::min<size_t>(finished_.size(), kMaxChunksPerUpdate);
+				finished.assign(std::make_move_iterator(finished_.end() - count), std::make_move_iterator(finished_.end()));
+				finished_.resize(finished_.size() - count);
+				applied += (unsigned int)count + failed_since_update_;
+				failed_since_update_ = 0;
+			}
+
+			if (!loading() && load_ms == 0.0f) load_ms = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start_time_).count();
+			if (finished.empty()) return 0;
+
+			// a chunk's rows are runs of 16 columns in the map, and rows of the map's texture
+			int column_words = map.size.y / MAP_CELLS_PER_WORD;
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, map_texture);
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, map.size.x * column_words);
+
+			for (const Chunk_& chunk : finished) {
+				glm::ivec2 cell = (chunk.chunk - min_chunk_) * kChunkSize;
+				for (int z = 0; z < kChunkSize; z++)
+					std::memcpy(&map.data[(size_t(cell.y + z) * map.size.x + cell.x) * column_words], &chunk.words[z * kChunkSize * column_words], kChunkSize * column_words * sizeof(uint32_t));
+
+				glTexSubImage2D(GL_TEXTURE_2D, 0, cell.x * column_words, cell.y, kChunkSize * column_words, kChunkSize, GL_RED_INTEGER, GL_UNSIGNED_INT,
+					&map.data[(size_t(cell.y) * map.size.x + cell.x) * column_words]);
+			}
+
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+			return (int)finished.size();
+		}
+
+		void stop() {
+			quit_ = true;
+			for (std::thread& worker : workers_) worker.join();
+			workers_.clear();
+
+			regions_.clear();
+			jobs_.clear();
+			chunk_jobs_.clear();
+			finished_.clear();
+			applied = 0;
+			load_ms = 0.0f;
+		}
+
+	private:
+		static const int kSectorSize = 4096;
+		static const int kSectionSize = 16;
+		static const int kFirstNonSpanningVersion = 2527; // data version of the first snapshot whose block states don't span longs
+		static const size_t kMaxChunkBytes = size_t(64) << 20; // inflated, real chunks take a few hundred kB
+
+		struct Job_ {
+			int region;
+			glm::ivec2 chunk;
+			uint32_t offset, sectors; // in the region file
+		};
+
+		// packed columns, 16 per row, in the map's layout
+		struct Chunk_ {
+			glm::ivec2 chunk;
+			std::vector<uint32_t> words;
+		};
+
+		BlockTable table_;
+		int min_y_ = 0, height_ = 0;
+		glm::ivec2 min_chunk_ = glm::ivec2(0), chunks_ = glm::ivec2(0);
+
+		std::vector<std::string> regions_;
+		std::vector<Job_> jobs_;
+		std::vector<int> chunk_jobs_; // job of every chunk in the bounds, -1 if there is none
+
+		std::vector<std::thread> workers_;
+		std::atomic<size_t> next_job_{ 0 };
+		std::atomic<bool> quit_{ false };
+
+		std::mutex mutex_;
+		std::vector<Chunk_> finished_;
+		unsigned int failed_since_update_ = 0;
+
+		std::chrono::high_resolution_clock::time_point start_time_;
+
+		// the chunk locations of a region file named r.<x>.<z>.mca
+		bool readHeader_(const std::string& file_path) {
+			size_t name_start = file_path.find_last_of("/\\");
+			std::string name = file_path.substr(name_start == std::string::npos ? 0 : name_start + 1);
+
+			glm::ivec2 region;
+			if (sscanf_s(name.c_str(), "r.%d.%d.mca", &region.x, &region.y) != 2) {
+				std::cerr << file_path << ": expected a region file named r.<x>.<z>.mca" << std::endl;
+				return false;
+			}
+
+			FILE* fp;
+			if (fopen_s(&fp, file_path.c_str(), "rb") != 0) {
+				std::cerr << "cannot open file " << file_path << std::endl;
+				return false;
+			}
+
+			uint8_t header[kSectorSize];
+			size_t read = fread(header, 1, kSectorSize, fp);
+			fclose(fp);
+			if (read != kSectorSize) return true; // empty region
+
+			for (int i = 0; i < 1024; i++) {
+				uint32_t offset = header[i * 4] << 16 | header[i * 4 + 1] << 8 | header[i * 4 + 2];
+				uint32_t sectors = header[i * 4 + 3];
+				if (offset == 0 || sectors == 0) continue; // not generated
+
+				jobs_.push_back({ int(regions_.size()), region * 32 + glm::ivec2(i % 32, i / 32), offset, sectors });
+			}
+
+			regions_.push_back(file_path);
+			return true;
+		}
+
+		void work_() {
+			std::vector<FILE*> files(regions_.size(), nullptr);
+			std::vector<uint8_t> compressed, inflated;
+
+			while (!quit_) {
+				size_t index = next_job_++;
+				if (index >= jobs_.size()) break;
+
+				const Job_& job = jobs_[index];
+				Chunk_ chunk = { job.chunk, std::vector<uint32_t>(kChunkSize * kChunkSize * height_ / MAP_CELLS_PER_WORD, 0) };
+
+				bool loaded = readChunk_(job, files, &compressed, &inflated) && decode_(inflated, &chunk);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (loaded) finished_.push_back(std::move(chunk));
+				else {
+					failed++;
+					failed_since_update_++;
+				}
+			}
+
+			for (FILE* file : files) if (file) fclose(file);
+		}
+
+		bool readChunk_(const Job_& job, std::vector<FILE*>& files, std::vector<uint8_t>* compressed, std::vector<uint8_t>* inflated) {
+			FILE*& fp = files[job.region];
+			if (!fp && fopen_s(&fp, regions_[job.region].c_str(), "rb") != 0) return false;
+
+			compressed->resize(size_t(job.sectors) * kSectorSize);
+			if (_fseeki64(fp, int64_t(job.offset) * kSectorSize, SEEK_SET) != 0) return false;
+			size_t read = fread(compressed->data(), 1, compressed->size(), fp);
+			if (read < 5) return false;
+
+			// big endian length, counting the compression byte: 1 gzip, 2 zlib, 3 none. lz4 and chunks kept in
+			// separate files aren't read
+			uint32_t length = (*compressed)[0] << 24 | (*compressed)[1] << 16 | (*compressed)[2] << 8 | (*compressed)[3];
+			uint8_t compression = (*compressed)[4];
+			if (length < 1 || size_t(length) + 4 > read) return false;
+
+			if (compression == 3) {
+				inflated->assign(compressed->begin() + 5, compressed->begin() + 4 + length);
+				return true;
+			}
+			if (compression != 1 && compression != 2) return false;
+
+			return nbt::decompress(compressed->data() + 5, length - 1, inflated, kMaxChunkBytes);
+		}
+
+		bool decode_(const std::vector<uint8_t>& data, Chunk_* chunk) {
+			nbt::Tag root;
+			if (!nbt::Reader(data.data(), data.size()).read(&root)) return false;
+
+			const nbt::Tag* version = root.get("DataVersion", nbt::TAG_INT);
+			bool spanning = version && version->number < kFirstNonSpanningVersion;
+
+			// 1.18 moved the sections out of 'Level' and the block states into their own compound
+			const nbt::Tag* level = root.get("Level", nbt::TAG_COMPOUND);
+			const nbt::Tag* sections = level ? level->get("Sections", nbt::TAG_LIST) : root.get("sections", nbt::TAG_LIST);
+			if (!sections) return true; // nothing generated yet
+
+			for (const nbt::Tag& section : sections->list) {
+				const nbt::Tag* y = section.get("Y", nbt::TAG_BYTE);
+				if (!y) continue;
+
+				const nbt::Tag* palette;
+				const nbt::Tag* states;
+				if (level) {
+					palette = section.get("Palette", nbt::TAG_LIST);
+					states = section.get("BlockStates", nbt::TAG_LONG_ARRAY);
+				}
+				else {
+					const nbt::Tag* block_states = section.get("block_states", nbt::TAG_COMPOUND);
+					if (!block_states) continue;
+					palette = block_states->get("palette", nbt::TAG_LIST);
+					states = block_states->get("data", nbt::TAG_LONG_ARRAY);
+				}
+				if (!palette || palette->list.empty()) continue;
+
+				decodeSection_(int(y->number) * kSectionSize - min_y_, paletteBricks(*palette, table_), states, spanning, chunk);
+			}
+
+			return true;
+		}
+
+		// writes the section's bricks into the chunk's packed columns, section_y is its bottom in the map
+		void decodeSection_(int section_y, const std::vector<uint8_t>& bricks, const nbt::Tag* states, bool spanning, Chunk_* chunk) {
+			if (section_y + kSectionSize <= 0 || section_y >= height_) return;
+
+			int column_words = height_ / MAP_CELLS_PER_WORD;
+			int bits = 4;
+			while ((1u << bits) < bricks.size()) bits++;
+
+			// a single entry palette has no data, the whole section is that block
+			bool uniform = bricks.size() == 1 || !states;
+			uint64_t mask = (1ull << bits) - 1;
+			int per_long = 64 / bits;
+
+			for (int i = 0; i < kSectionSize * kSectionSize * kSectionSize; i++) {
+				size_t entry = 0;
+				if (!uniform) {
+					if (spanning) {
+						size_t bit = size_t(i) * bits;
+						size_t word = bit / 64;
+						int shift = int(bit % 64);
+						if (word >= states->array.size()) break;
+
+						uint64_t value = uint64_t(states->array[word]) >> shift;
+						if (shift + bits > 64 && word + 1 < states->array.size()) value |= uint64_t(states->array[word + 1]) << (64 - shift);
+						entry = size_t(value & mask);
+					}
+					else {
+						size_t word = i / per_long;
+						if (word >= states->array.size()) break;
+						entry = size_t((uint64_t(states->array[word]) >> ((i % per_long) * bits)) & mask);
+					}
+				}
+
+				uint8_t brick = entry < bricks.size() ? bricks[entry] : 0;
+				if (!brick) continue;
+
+				// y, z, x order in the section
+				int x = i % kSectionSize, z = i / kSectionSize % kSectionSize, y = section_y + i / (kSectionSize * kSectionSize);
+				if (y < 0 || y >= height_) continue;
+
+				chunk->words[(z * kChunkSize + x) * column_words + y / MAP_CELLS_PER_WORD] |= uint32_t(brick) << ((y % MAP_CELLS_PER_WORD) * MAP_CELL_BITS);
+			}
+		}
+	};
+
+	// Sponge schematic (.schem, versions 2 and 3): gzip compressed NBT holding the blocks' palette indices as varints,
+	// x fastest, then z, then y. One pass finds where every 8 layers start, then the slabs are decoded on all cores,
+	// each filling its own packed words of the map's columns directly. nullptr if the file can't be read
+	std::unique_ptr<BrickMap> readSchematic(const char* file_path, const BlockTable& table) {
+		FILE* fp;
+		if (fopen_s(&fp, file_path, "rb") != 0) {
+			std::cerr << "cannot open file " << file_path << std::endl;
+			return nullptr;
+		}
+
+		std::vector<uint8_t> compressed(_filelength(_fileno(fp)));
+		fread(compressed.data(), 1, compressed.size(), fp);
+		fclose(fp);
+
+		std::vector<uint8_t> inflated;
+		nbt::Tag root;
+		if (!nbt::decompress(compressed.data(), compressed.size(), &inflated) || !nbt::Reader(inflated.data(), inflated.size()).read(&root)) {
+			std::cerr << file_path << ": not a gzip compressed NBT file." << std::endl;
+			return nullptr;
+		}
+
+		// version 3 nests the schematic in the root and its blocks in their own compound
+		const nbt::Tag* schematic = root.get("Schematic", nbt::TAG_COMPOUND);
+		if (!schematic) schematic = &root;
+		const nbt::Tag* blocks = schematic->get("Blocks", nbt::TAG_COMPOUND);
+
+		const nbt::Tag* width = schematic->get("Width", nbt::TAG_SHORT);
+		const nbt::Tag* height = schematic->get("Height", nbt::TAG_SHORT);
+		const nbt::Tag* length = schematic->get("Length", nbt::TAG_SHORT);
+		const nbt::Tag* palette = blocks ? blocks->get("Palette", nbt::TAG_COMPOUND) : schematic->get("Palette", nbt::TAG_COMPOUND);
+		const nbt::Tag* block_data = blocks ? blocks->get("Data", nbt::TAG_BYTE_ARRAY) : schematic->get("BlockData", nbt::TAG_BYTE_ARRAY);
+
+		if (!width || !height || !length || !palette || !block_data) {
+			std::cerr << file_path << ": missing the schematic's size, palette or block data." << std::endl;
+			return nullptr;
+		}
+
+		// the shorts are unsigned
+		glm::ivec3 size(uint16_t(width->number), uint16_t(height->number), uint16_t(length->number));
+		if (size.x == 0 || size.y == 0 || size.z == 0) {
+			std::cerr << file_path << ": the schematic is empty." << std::endl;
+			return nullptr;
+		}
+
+		// palette entries are block states, 'minecraft:oak_stairs[facing=east]'
+		std::vector<uint8_t> bricks;
+		for (const std::pair<std::string, nbt::Tag>& entry : palette->compound) {
+			if (entry.second.type != nbt::TAG_INT || entry.second.number < 0 || entry.second.number > 0xFFFF) continue;
+
+			size_t index = size_t(entry.second.number);
+			if (index >= bricks.size()) bricks.resize(index + 1, 0);
+			bricks[index] = table.brick(entry.first.substr(0, entry.first.find('[')));
+		}
+
+		// offsets of every 8 layers' first varint, the last byte of a varint has the high bit clear
+		const std::vector<uint8_t>& data = block_data->bytes;
+		size_t layer_blocks = size_t(size.x) * size.z;
+		int slab_count = (size.y + 7) / 8;
+		std::vector<size_t> slab_offsets(slab_count + 1, data.size());
+		slab_offsets[0] = 0;
+
+		size_t read = 0;
+		for (size_t i = 0; i < data.size() && read < layer_blocks * size.y; i++) {
+			if (data[i] & 0x80) continue;
+			read++;
+			if (read % (layer_blocks * 8) == 0) slab_offsets[read / (layer_blocks * 8)] = i + 1;
+		}
+
+		if (read < layer_blocks * size.y) {
+			std::cerr << file_path << ": block data is cut short." << std::endl;
+			return nullptr;
+		}
+
+		std::unique_ptr<BrickMap> map(new BrickMap(size));
+		int column_words = map->size.y / MAP_CELLS_PER_WORD;
+		std::atomic<int> next_slab{ 0 };
+
+		auto decode = [&]() {
+			for (int slab = next_slab++; slab < slab_count; slab = next_slab++) {
+				const uint8_t* varint = data.data() + slab_offsets[slab];
+				// 8 layers fill whole words of the columns, MAP_CELLS_PER_WORD divides 8
+				int last_y = std::min(slab * 8 + 8, size.y);
+
+				for (int y = slab * 8; y < last_y; y++) for (int z = 0; z < size.z; z++) for (int x = 0; x < size.x; x++) {
+					uint32_t index = 0;
+					for (int shift = 0;; shift += 7) {
+						uint8_t byte = *varint++;
+						if (shift < 32) index |= uint32_t(byte & 0x7F) << shift;
+						if (!(byte & 0x80)) break;
+					}
+
+					uint8_t brick = index < bricks.size() ? bricks[index] : 0;
+					if (brick) map->data[(size_t(z) * size.x + x) * column_words + y / MAP_CELLS_PER_WORD] |= uint32_t(brick) << ((y % MAP_CELLS_PER_WORD) * MAP_CELL_BITS);
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		int thread_count = (int)std::min<unsigned int>(std::max(1u, std::thread::hardware_concurrency()), slab_count);
+		for (int t = 0; t < thread_count; t++) threads.emplace_back(decode);
+		for (std::thread& thread : threads) thread.join();
+
+		map->camera = overviewCamera(map->size);
+		return map;
+	}
+}
+
+#endif
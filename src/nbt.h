@@ -0,0 +1,180 @@
+#ifndef NBT_H
+#define NBT_H
+
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// Minecraft's Named Binary Tag format: big endian, a root compound holding named tags. Used by the region
+// (minecraft.h) and schematic files, both zlib or gzip compressed
+namespace nbt {
+	enum TagType {
+		TAG_END, TAG_BYTE, TAG_SHORT, TAG_INT, TAG_LONG, TAG_FLOAT, TAG_DOUBLE,
+		TAG_BYTE_ARRAY, TAG_STRING, TAG_LIST, TAG_COMPOUND, TAG_INT_ARRAY, TAG_LONG_ARRAY
+	};
+
+	struct Tag {
+		TagType type = TAG_END;
+		int64_t number = 0; // byte, short, int and long
+		double real = 0.0; // float and double
+		std::string string;
+		std::vector<uint8_t> bytes; // byte array
+		std::vector<int64_t> array; // int and long arrays
+		std::vector<Tag> list;
+		std::vector<std::pair<std::string, Tag>> compound;
+
+		// compound member, nullptr if missing or of another type
+		const Tag* get(const char* name, TagType member_type) const {
+			for (const std::pair<std::string, Tag>& member : compound)
+				if (member.first == name) return member.second.type == member_type ? &member.second : nullptr;
+			return nullptr;
+		}
+	};
+
+	const size_t kMaxInflatedSize = size_t(1) << 30; // a corrupt or hostile file can't inflate beyond this
+
+	// inflates zlib or gzip data, the header tells which. fails if the data inflates to more than max_size bytes
+	bool decompress(const uint8_t* data, size_t size, std::vector<uint8_t>* out, size_t max_size = kMaxInflatedSize) {
+		z_stream stream = {};
+		if (inflateInit2(&stream, 15 + 32) != Z_OK) return false;
+
+		stream.next_in = const_cast<Bytef*>(data);
+		stream.avail_in = (uInt)size;
+
+		out->resize(std::min(size * 4 + 1024, max_size));
+		int result = Z_OK;
+		while (result == Z_OK) {
+			if (stream.total_out == out->size()) {
+				if (out->size() == max_size) break;
+				out->resize(std::min(out->size() * 2, max_size));
+			}
+			stream.next_out = out->data() + stream.total_out;
+			stream.avail_out = (uInt)(out->size() - stream.total_out);
+			result = inflate(&stream, Z_NO_FLUSH);
+		}
+
+		out->resize(stream.total_out);
+		inflateEnd(&stream);
+		return result == Z_STREAM_END;
+	}
+
+	class Reader
+	{
+	public:
+		Reader(const uint8_t* data, size_t size) : data_(data), end_(data + size) {}
+
+		// the root compound, false if the data is cut short or malformed
+		bool read(Tag* root) {
+			if (byte_() != TAG_COMPOUND) return false;
+			string_();
+			return payload_(TAG_COMPOUND, root, 0) && !failed_;
+		}
+
+	private:
+		static const int kMaxDepth = 512; // nesting the format allows
+
+		const uint8_t* data_;
+		const uint8_t* end_;
+		bool failed_ = false;
+
+		bool has_(size_t count) {
+			if (size_t(end_ - data_) < count) failed_ = true;
+			return !failed_;
+		}
+
+		uint64_t bigEndian_(int count) {
+			if (!has_(count)) return 0;
+			uint64_t value = 0;
+			for (int i = 0; i < count; i++) value = value << 8 | *data_++;
+			return value;
+		}
+
+		uint8_t byte_() {
+			return (uint8_t)bigEndian_(1);
+		}
+
+		std::string string_() {
+			size_t length = (size_t)bigEndian_(2);
+			if (!has_(length)) return std::string();
+			std::string value((const char*)data_, length);
+			data_ += length;
+			return value;
+		}
+
+		size_t length_() {
+			int32_t length = (int32_t)bigEndian_(4);
+			return length > 0 ? size_t(length) : 0;
+		}
+
+		bool payload_(uint8_t type, Tag* tag, int depth) {
+			if (depth > kMaxDepth) return false;
+			tag->type = TagType(type);
+
+			switch (type) {
+			case TAG_BYTE: tag->number = (int8_t)bigEndian_(1); break;
+			case TAG_SHORT: tag->number = (int16_t)bigEndian_(2); break;
+			case TAG_INT: tag->number = (int32_t)bigEndian_(4); break;
+			case TAG_LONG: tag->number = (int64_t)bigEndian_(8); break;
+			case TAG_FLOAT: {
+				uint32_t bits = (uint32_t)bigEndian_(4);
+				float value;
+				std::memcpy(&value, &bits, sizeof(value));
+				tag->real = value;
+				break;
+			}
+			case TAG_DOUBLE: {
+				uint64_t bits = bigEndian_(8);
+				std::memcpy(&tag->real, &bits, sizeof(tag->real));
+				break;
+			}
+			case TAG_BYTE_ARRAY: {
+				size_t length = length_();
+				if (!has_(length)) return false;
+				tag->bytes.assign(data_, data_ + length);
+				data_ += length;
+				break;
+			}
+			case TAG_STRING: tag->string = string_(); break;
+			case TAG_LIST: {
+				uint8_t element_type = byte_();
+				size_t length = length_();
+				if (element_type > TAG_LONG_ARRAY || !has_(length)) return false; // every element takes a byte at least, unless empty
+				tag->list.resize(length);
+				for (Tag& element : tag->list)
+					if (!payload_(element_type, &element, depth + 1)) return false;
+				break;
+			}
+			case TAG_COMPOUND:
+				while (!failed_) {
+					uint8_t member_type = byte_();
+					if (member_type == TAG_END) break;
+					if (member_type > TAG_LONG_ARRAY) return false;
+
+					tag->compound.push_back({ string_(), Tag() });
+					if (!payload_(member_type, &tag->compound.back().second, depth + 1)) return false;
+				}
+				break;
+			case TAG_INT_ARRAY:
+			case TAG_LONG_ARRAY: {
+				int element_size = type == TAG_INT_ARRAY ? 4 : 8;
+				size_t length = length_();
+				if (!has_(length * element_size)) return false;
+				tag->array.resize(length);
+				for (int64_t& element : tag->array)
+					element = element_size == 4 ? (int64_t)(int32_t)bigEndian_(4) : (int64_t)bigEndian_(8);
+				break;
+			}
+			case TAG_END: break;
+			default: return false;
+			}
+
+			return !failed_;
+		}
+	};
+}
+
+#endif
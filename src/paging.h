@@ -0,0 +1,320 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <algorithm>
+#include <iterator>
+#include <iostream>
+#include <cmath>
+#include "brick.h"
+
+// Out-of-core brick map: the map is split into pages of 16x16 columns, loaded on worker threads around the camera
+// into a fixed size pool texture. A page table texture holds every page's pool slot plus one, 0 for the pages that
+// aren't resident, which are traced as empty. When the pool is full the page wanted least recently is evicted, so
+// the memory stays bounded whatever the size of the world
+class PagedMap
+{
+public:
+	static const int kPageSize = 16; // columns along x and z, must match PAGE_SIZE in fragment.frag
+	static const int kMaxPagesPerUpdate = 32; // uploaded per frame, bounds the hitch
+
+	// fills the packed columns of a page (z rows of x columns, like the map), called on the workers
+	typedef std::function<bool(const glm::ivec2& page, std::vector<uint32_t>* words)> Loader;
+
+	// running counts, failed is written by the workers
+	unsigned int loads = 0, evictions = 0;
+	std::atomic<unsigned int> failed{ 0 };
+
+	~PagedMap() {
+		destroy();
+	}
+
+	// radius is in pages around the camera, the pool holds a ring of pages more so turning back is free. the pool
+	// texture is bound on pool_slot and the page table on table_slot
+	bool create(const glm::ivec3& map_size, int radius, Loader loader, unsigned int pool_slot, unsigned int table_slot) {
+		destroy();
+
+		radius_ = radius;
+		loader_ = loader;
+		column_words_ = map_size.y / MAP_CELLS_PER_WORD;
+		pages_ = (glm::ivec2(map_size.x, map_size.z) + kPageSize - 1) / kPageSize;
+
+		// the pool is a grid of pages in a texture, as wide as the texture size allows
+		int max_texture_size;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+		int page_width = kPageSize * column_words_;
+		int slot_count = (int)std::min<size_t>(size_t(2 * radius + 3) * (2 * radius + 3), size_t(pages_.x) * pages_.y);
+		pool_columns_ = std::min(slot_count, max_texture_size / page_width);
+		if (pool_columns_ == 0 || pages_.x > max_texture_size || pages_.y > max_texture_size) {
+			std::cerr << "The paged map is too tall or too large for the texture size." << std::endl;
+			return false;
+		}
+
+		slot_count = std::min(slot_count, pool_columns_ * (max_texture_size / kPageSize));
+
+		// a pool the texture size capped can't hold every page in range, they would evict each other forever
+		if (size_t(slot_count) < size_t(pages_.x) * pages_.y) {
+			int fit = (int(std::sqrt(double(slot_count))) - 1) / 2;
+			if (fit < radius_) {
+				std::cout << "The page pool only holds " << slot_count << " pages, the radius is reduced to " << fit << "." << std::endl;
+				radius_ = fit;
+			}
+		}
+
+		int pool_rows = (slot_count + pool_columns_ - 1) / pool_columns_;
+
+		glGenTextures(1, &pool_tex_);
+		glActiveTexture(GL_TEXTURE0 + pool_slot);
+		glBindTexture(GL_TEXTURE_2D, pool_tex_);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, pool_columns_ * page_width, pool_rows * kPageSize, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+		setNearest_();
+
+		std::vector<uint32_t> table(size_t(pages_.x) * pages_.y, 0);
+		glGenTextures(1, &table_tex_);
+		glActiveTexture(GL_TEXTURE0 + table_slot);
+		glBindTexture(GL_TEXTURE_2D, table_tex_);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, pages_.x, pages_.y, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, table.data());
+		setNearest_();
+		table_slot_ = table_slot;
+		pool_slot_ = pool_slot;
+
+		slots_.assign(slot_count, Slot_());
+		page_slots_.assign(size_t(pages_.x) * pages_.y, -1);
+		page_requested_.assign(size_t(pages_.x) * pages_.y, false);
+
+		quit_ = false;
+		int thread_count = (int)std::max(1u, std::thread::hardware_concurrency() / 2);
+		for (int t = 0; t < thread_count; t++) workers_.emplace_back(&PagedMap::work_, this);
+		return true;
+	}
+
+	// requests the missing pages around the camera, nearest first, and pages in the loaded ones. returns
+	// whether the resident set changed
+	bool update(const glm::vec3& camera_position) {
+		if (slots_.empty()) return false;
+		frame_++;
+
+		center_ = glm::clamp(glm::ivec2(glm::floor(glm::vec2(camera_position.x, camera_position.z) / float(kPageSize))), glm::ivec2(0), pages_ - 1);
+
+		for (int z = glm::max(center_.y - radius_, 0); z <= glm::min(center_.y + radius_, pages_.y - 1); z++)
+			for (int x = glm::max(center_.x - radius_, 0); x <= glm::min(center_.x + radius_, pages_.x - 1); x++) {
+				size_t page = pageIndex_(glm::ivec2(x, z));
+				if (page_slots_[page] >= 0) slots_[page_slots_[page]].wanted = frame_;
+			}
+
+		std::vector<Result_> results;
+		bool requested;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+
+			// the queue is rebuilt from every page in range that isn't resident or taken by a worker, so requests
+			// that fell out of range are dropped and the rest are ordered by the new center
+			for (const glm::ivec2& page : requests_) page_requested_[pageIndex_(page)] = false;
+
+			std::vector<glm::ivec2> missing;
+			for (int z = glm::max(center_.y - radius_, 0); z <= glm::min(center_.y + radius_, pages_.y - 1); z++)
+				for (int x = glm::max(center_.x - radius_, 0); x <= glm::min(center_.x + radius_, pages_.x - 1); x++) {
+					size_t page = pageIndex_(glm::ivec2(x, z));
+					if (page_slots_[page] < 0 && !page_requested_[page]) missing.push_back(glm::ivec2(x, z));
+				}
+			std::sort(missing.begin(), missing.end(), [this](const glm::ivec2& a, const glm::ivec2& b) { return distance_(a) < distance_(b); });
+
+			requests_.assign(missing.begin(), missing.end());
+			for (const glm::ivec2& page : requests_) page_requested_[pageIndex_(page)] = true;
+
+			size_t count = std::min<size_t>(results_.size(), kMaxPagesPerUpdate);
+			results.assign(std::make_move_iterator(results_.begin()), std::make_move_iterator(results_.begin() + count));
+			results_.erase(results_.begin(), results_.begin() + count);
+			for (const Result_& result : results) page_requested_[pageIndex_(result.page)] = false;
+			requested = !requests_.empty();
+		}
+		if (requested) wake_.notify_all();
+
+		bool changed = false;
+		for (Result_& result : results) changed |= pageIn_(result);
+		return changed;
+	}
+
+	// the map cell from the resident pages, empty where they aren't loaded
+	uint8_t getVoxel(int x, int y, int z) const {
+		if (x < 0 || y < 0 || z < 0 || x >= pages_.x * kPageSize || y >= column_words_ * MAP_CELLS_PER_WORD || z >= pages_.y * kPageSize) return 0;
+
+		int slot = page_slots_[pageIndex_(glm::ivec2(x, z) / kPageSize)];
+		if (slot < 0) return 0;
+
+		uint32_t row = slots_[slot].words[((z % kPageSize) * kPageSize + x % kPageSize) * column_words_ + y / MAP_CELLS_PER_WORD];
+		return (row >> ((y % MAP_CELLS_PER_WORD) * MAP_CELL_BITS)) & ((1u << MAP_CELL_BITS) - 1u);
+	}
+
+	// pages around the camera that are kept resident, smaller than requested if the pool couldn't hold them
+	int radius() const {
+		return radius_;
+	}
+
+	bool active() const {
+		return !slots_.empty();
+	}
+
+	int poolColumns() const {
+		return pool_columns_;
+	}
+
+	int slotCount() const {
+		return int(slots_.size());
+	}
+
+	int residentCount() const {
+		return int(std::count_if(slots_.begin(), slots_.end(), [](const Slot_& slot) { return slot.page.x >= 0; }));
+	}
+
+	size_t poolBytes() const {
+		return slots_.size() * kPageSize * kPageSize * column_words_ * sizeof(uint32_t);
+	}
+
+	unsigned int poolTexture() const {
+		return pool_tex_;
+	}
+
+	void destroy() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			quit_ = true;
+		}
+		wake_.notify_all();
+		for (std::thread& worker : workers_) worker.join();
+		workers_.clear();
+
+		if (pool_tex_) {
+			glDeleteTextures(1, &pool_tex_);
+			glDeleteTextures(1, &table_tex_);
+			pool_tex_ = table_tex_ = 0;
+		}
+
+		slots_.clear();
+		page_slots_.clear();
+		page_requested_.clear();
+		requests_.clear();
+		results_.clear();
+	}
+
+private:
+	struct Slot_ {
+		glm::ivec2 page = glm::ivec2(-1);
+		unsigned int wanted = 0; // last update the page was in range
+		std::vector<uint32_t> words; // cpu copy, for collision and picking
+	};
+
+	struct Result_ {
+		glm::ivec2 page;
+		std::vector<uint32_t> words;
+	};
+
+	Loader loader_;
+	int radius_ = 0;
+	int column_words_ = 0;
+	glm::ivec2 pages_ = glm::ivec2(0);
+	glm::ivec2 center_ = glm::ivec2(0);
+	unsigned int frame_ = 0;
+
+	unsigned int pool_tex_ = 0, table_tex_ = 0;
+	unsigned int pool_slot_ = 0, table_slot_ = 0;
+	int pool_columns_ = 0;
+
+	std::vector<Slot_> slots_;
+	std::vector<int> page_slots_; // -1 if not resident
+	std::vector<bool> page_requested_; // queued, being loaded or waiting to be paged in, written under the lock
+
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<glm::ivec2> requests_;
+	std::deque<Result_> results_;
+	bool quit_ = false;
+
+	size_t pageIndex_(const glm::ivec2& page) const {
+		return size_t(page.y) * pages_.x + page.x;
+	}
+
+	int distance_(const glm::ivec2& page) const {
+		glm::ivec2 offset = glm::abs(page - center_);
+		return glm::max(offset.x, offset.y);
+	}
+
+	// moves a loaded page into a free slot or the least recently wanted one, unless it isn't in range anymore
+	bool pageIn_(Result_& result) {
+		if (distance_(result.page) > radius_ || page_slots_[pageIndex_(result.page)] >= 0) return false;
+
+		int slot = -1;
+		for (int i = 0; i < int(slots_.size()); i++) {
+			if (slots_[i].wanted == frame_) continue; // in range
+			if (slot < 0 || slots_[i].wanted < slots_[slot].wanted) slot = i;
+		}
+		if (slot < 0) return false;
+
+		Slot_& target = slots_[slot];
+		if (target.page.x >= 0) {
+			page_slots_[pageIndex_(target.page)] = -1;
+			setTableEntry_(target.page, 0);
+			evictions++;
+		}
+
+		target.page = result.page;
+		target.wanted = frame_;
+		target.words = std::move(result.words);
+		page_slots_[pageIndex_(result.page)] = slot;
+
+		int page_width = kPageSize * column_words_;
+		glActiveTexture(GL_TEXTURE0 + pool_slot_);
+		glBindTexture(GL_TEXTURE_2D, pool_tex_);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % pool_columns_) * page_width, (slot / pool_columns_) * kPageSize, page_width, kPageSize,
+			GL_RED_INTEGER, GL_UNSIGNED_INT, target.words.data());
+
+		setTableEntry_(result.page, uint32_t(slot) + 1);
+		loads++;
+		return true;
+	}
+
+	void setTableEntry_(const glm::ivec2& page, uint32_t entry) {
+		glActiveTexture(GL_TEXTURE0 + table_slot_);
+		glBindTexture(GL_TEXTURE_2D, table_tex_);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, page.x, page.y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &entry);
+	}
+
+	void work_() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		while (true) {
+			wake_.wait(lock, [this]() { return quit_ || !requests_.empty(); });
+			if (quit_) return;
+
+			Result_ result = { requests_.front(), std::vector<uint32_t>() };
+			requests_.pop_front();
+			lock.unlock();
+
+			// a page that can't be read stays empty, it isn't requested again while in range
+			bool loaded = loader_(result.page, &result.words);
+			if (!loaded) result.words.assign(size_t(kPageSize) * kPageSize * column_words_, 0);
+
+			if (!loaded) failed++;
+			lock.lock();
+			results_.push_back(std::move(result));
+		}
+	}
+
+	static void setNearest_() {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+};
+
+#endif
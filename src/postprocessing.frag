@@ -4,15 +4,35 @@ out vec3 FragColor;
 
 in vec2 TexCoord;
 
-uniform uvec2 Resolution;
 uniform int OutputNum;
 uniform float Gamma;
-uniform int BlurSize;
 
+// per frame data shared by all passes, must match FrameData in main.cpp
+layout (std140) uniform FrameData {
+	mat4 CamRotation;
+	mat4 LastCamRotation;
+	vec3 CamPosition;
+	vec3 LastCamPosition;
+	uvec2 RenderResolution; // size of the full resolution targets, may be smaller than the window
+	uint FrameCount;
+	int UpscaleMode; // 0 - native, 1 - checkerboard (1/2 of the pixels per frame), 2 - interleaved (1/4)
+	int IndirectScale; // how many times lower the illumination resolution is
+	vec2 Jitter; // sub-pixel offset of this frame's primary rays, in screen coordinates
+	vec2 LastJitter;
+};
+
+// blurred illumination and the first hits it was traced from, at RenderResolution/IndirectScale
 uniform sampler2D Texture;
+uniform isampler2D IllumNormalTex;
+uniform sampler2D IllumDepthTex;
+uniform sampler2D IllumHistoryTex;
+uniform sampler2D MomentsTex; // mipmapped when sampling adaptively, b is the sampling need
+uniform usampler2D TraversalTex;
+uniform float TraversalScale; // step count shown as the hottest color
+
+// full resolution first hits
 uniform sampler2D AlbedoTex;
-uniform sampler2D EmissionTex;
-uniform sampler2D HistoryTex;
+uniform sampler2D HistoryEmissionTex;
 uniform isampler2D NormalTex;
 uniform sampler2D DepthTex;
 
@@ -26,6 +46,15 @@ vec3 ACES(const vec3 x) {
 	return (x * (a * x + b)) / (x * (c * x + d) + e);
 }
 
+vec3 heatmap(float t){
+	t = clamp(t, 0., 1.);
+	return clamp(vec3(1.5 - abs(4.*t - vec3(3., 2., 1.))), 0., 1.); // jet-like, blue -> red
+}
+
+ivec3 DecodeNormal(int code){
+	return ivec3(code%3, (code/3)%3, code/9) - ivec3(1);
+}
+
 vec4 averageSample(sampler2D tex, ivec2 loc){
 	return
 		texelFetch(tex, loc, 0)*0.6 +
@@ -35,35 +64,48 @@ vec4 averageSample(sampler2D tex, ivec2 loc){
 		texelFetch(tex, loc + ivec2(0, -1), 0)*0.1;
 }
 
-vec4 boxBlurIllumination(ivec2 loc, int size, int seperation){
-	vec4 accu = vec4(0.);
-	ivec4 normal = texelFetch(NormalTex, loc, 0);
+// joint bilateral upsampling of the blurred illumination (see blur.frag): the 2x2 nearest texels are weighed by
+// their bilinear weight and by how close their first hit is to this pixel's. texels of another surface are left
+// out so lighting doesn't bleed across edges, when none of them matches the nearest one is taken
+vec3 upsampleIllumination(ivec2 loc){
+	if (IndirectScale == 1) return texelFetch(Texture, loc, 0).rgb;
+
+	int normal = texelFetch(NormalTex, loc, 0).r;
 	float depth = texelFetch(DepthTex, loc, 0).r;
-	int sampleCount = 0;
-
-	for (int i = -size; i <= size; i++){
-			for (int j = -size; j <= size; j++){
-				ivec2 currLoc = loc + ivec2(i, j) * seperation;
-				
-				if (texelFetch(NormalTex, currLoc, 0) == normal &&
-						abs(texelFetch(DepthTex, currLoc, 0).r - depth) < 0.1){
-					sampleCount++;
-					accu += texelFetch(Texture, currLoc, 0);
-				}
-			}
+
+	ivec2 illumSize = textureSize(Texture, 0);
+	vec2 illumPos = (vec2(loc) + 0.5)/float(IndirectScale) - 0.5;
+	ivec2 base = ivec2(floor(illumPos));
+	vec2 f = fract(illumPos);
+
+	vec3 accu = vec3(0.);
+	float weightSum = 0.;
+
+	for (int i = 0; i <= 1; i++){
+		for (int j = 0; j <= 1; j++){
+			ivec2 illumLoc = clamp(base + ivec2(i, j), ivec2(0), illumSize - 1);
+			if (texelFetch(IllumNormalTex, illumLoc, 0).r != normal) continue;
+
+			float weight = (i == 1 ? f.x : 1. - f.x) * (j == 1 ? f.y : 1. - f.y) + 0.001;
+			weight /= 1. + abs(texelFetch(IllumDepthTex, illumLoc, 0).r - depth) * 20.;
+
+			accu += weight * texelFetch(Texture, illumLoc, 0).rgb;
+			weightSum += weight;
+		}
 	}
 
-	return accu / sampleCount;
+	if (weightSum == 0.) return texelFetch(Texture, min(loc/IndirectScale, illumSize - 1), 0).rgb;
+	return accu / weightSum;
 }
 
 void main()
 {
-	ivec2 pixelLoc = ivec2((TexCoord*0.5+0.5)*Resolution);
+	ivec2 pixelLoc = ivec2((TexCoord*0.5+0.5)*RenderResolution);
 
 	vec3 albedo = texelFetch(AlbedoTex, pixelLoc, 0).rgb; //averageSample(AlbedoTex, pixelLoc).rgb;
 
-	vec3 incomingLight = boxBlurIllumination(pixelLoc, BlurSize, 2).rgb;//texelFetch(Texture, pixelLoc, 0).rgb;
-	float emission = texelFetch(EmissionTex, pixelLoc, 0).r;
+	vec3 incomingLight = upsampleIllumination(pixelLoc);
+	float emission = texelFetch(HistoryEmissionTex, pixelLoc, 0).g;
 
 	switch(OutputNum){
 		case 0: // Result
@@ -84,7 +126,7 @@ void main()
 		return;
 
 		case 5: // Normal
-		FragColor = texelFetch(NormalTex, pixelLoc, 0).rgb;
+		FragColor = DecodeNormal(texelFetch(NormalTex, pixelLoc, 0).r);
 		return;
 
 		case 6: // Depth
@@ -92,8 +134,18 @@ void main()
 		return;
 
 		case 7: // History
-		FragColor = texelFetch(HistoryTex, pixelLoc, 0).rrr/100.;
+		FragColor = texelFetch(IllumHistoryTex, pixelLoc/IndirectScale, 0).rrr/100.;
 		return;
+
+		case 8: // Traversal Steps
+		FragColor = heatmap(float(texelFetch(TraversalTex, pixelLoc/IndirectScale, 0).r)/TraversalScale);
+		return;
+
+		case 9: { // Sample Need, relative to the average over the geometry (only averaged while sampling adaptively)
+			vec4 meanMoments = textureLod(MomentsTex, vec2(0.5), 20.);
+			FragColor = heatmap(texelFetch(MomentsTex, pixelLoc/IndirectScale, 0).b / max(meanMoments.b / max(meanMoments.a, 1e-4) * 4., 1e-4));
+			return;
+		}
 	}
 
 	if (emission == -1.) {
@@ -0,0 +1,276 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include "imgui.h"
+
+// Per pass GPU timings (a ring of GL_TIME_ELAPSED queries per pass, read once their results are available so they
+// never stall)
+// and scoped CPU timings, with frame time graphs and CSV / Chrome trace export
+class Profiler
+{
+public:
+	static const unsigned int kHistorySize = 240; // frames kept for the graphs and the exports
+	static const int kQueryFrames = 4; // frames the GPU may lag behind before a pass' timing is dropped
+
+	struct Timer {
+		std::string name;
+		bool gpu;
+
+		float last_ms = 0.0f;
+		std::vector<float> history = std::vector<float>(kHistorySize, 0.0f);
+
+		// gpu, a query per frame of the ring
+		unsigned int queries[kQueryFrames] = { 0 };
+		bool pending[kQueryFrames] = { false };
+		unsigned int query_frames[kQueryFrames] = { 0 }; // frame each pending query was issued in
+
+		// cpu, summed over all the scopes of a frame
+		float frame_ms = 0.0f;
+		double start_us = 0.0;
+	};
+
+	// RAII helper for CPU scopes
+	class CpuScope {
+	public:
+		CpuScope(Profiler& profiler, const char* name) : profiler_(profiler), index_(profiler.beginCpu(name)) {}
+		~CpuScope() { profiler_.endCpu(index_); }
+
+	private:
+		Profiler& profiler_;
+		int index_;
+	};
+
+	Profiler() {
+		double now_us = nowUs_();
+		frames_.push_back({ 0, now_us, {}, now_us });
+	}
+
+	void destroy() {
+		for (Timer& timer : timers_)
+			if (timer.gpu) glDeleteQueries(kQueryFrames, timer.queries);
+		timers_.clear();
+	}
+
+	// GPU scopes use GL_TIME_ELAPSED, so they can't be nested. a query still pending kQueryFrames frames later is
+	// reused and its result lost
+	void beginGpu(const char* name) {
+		Timer& timer = timers_[findOrCreate_(name, true)];
+		int slot = querySlot_();
+		glBeginQuery(GL_TIME_ELAPSED, timer.queries[slot]);
+		timer.pending[slot] = true;
+		timer.query_frames[slot] = frames_.back().number;
+	}
+
+	void endGpu() {
+		glEndQuery(GL_TIME_ELAPSED);
+	}
+
+	int beginCpu(const char* name) {
+		int index = findOrCreate_(name, false);
+		timers_[index].start_us = nowUs_();
+		return index;
+	}
+
+	void endCpu(int index) {
+		Timer& timer = timers_[index];
+		double end_us = nowUs_();
+		timer.frame_ms += float((end_us - timer.start_us) / 1000.0);
+		frames_.back().events.push_back({ index, timer.start_us, end_us - timer.start_us });
+	}
+
+	// adds an externally measured CPU duration, e.g. the whole frame time
+	void record(const char* name, float ms) {
+		timers_[findOrCreate_(name, false)].frame_ms += ms;
+	}
+
+	// collects the GPU queries whose results arrived and this frame's CPU scopes, call once per frame after all
+	// scopes ended. a pass whose result isn't in yet keeps its last sample
+	void endFrame() {
+		int slot = querySlot_();
+
+		for (int i = 0; i < timers_.size(); i++) {
+			Timer& timer = timers_[i];
+
+			if (timer.gpu) {
+				bool issued = false, sampled = false;
+
+				// oldest first, the queries complete in order so the first one that isn't available ends the walk
+				for (int age = kQueryFrames - 1; age >= 0; age--) {
+					int query = (slot + kQueryFrames - age) % kQueryFrames;
+					if (!timer.pending[query]) continue;
+					issued = true;
+
+					GLint available = 0;
+					glGetQueryObjectiv(timer.queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+					if (!available) break;
+
+					GLuint64 elapsed_ns = 0;
+					glGetQueryObjectui64v(timer.queries[query], GL_QUERY_RESULT, &elapsed_ns);
+					timer.pending[query] = false;
+
+					pushSample_(timer, elapsed_ns / 1e6f);
+					addGpuEvent_(i, timer.query_frames[query], elapsed_ns / 1e3);
+					sampled = true;
+				}
+
+				if (!issued) pushSample_(timer, 0.0f); // pass didn't run
+				else if (!sampled) pushSample_(timer, timer.last_ms);
+			}
+			else {
+				pushSample_(timer, timer.frame_ms);
+				timer.frame_ms = 0.0f;
+			}
+		}
+
+		history_index_ = (history_index_ + 1) % kHistorySize;
+
+		double now_us = nowUs_();
+		frames_.push_back({ frame_number_++, now_us, {}, now_us });
+		if (frames_.size() > kHistorySize) frames_.pop_front();
+	}
+
+	float lastMs(const char* name) const {
+		for (const Timer& timer : timers_)
+			if (timer.name == name) return timer.last_ms;
+		return 0.0f;
+	}
+
+	void drawImGui() {
+		for (const Timer& timer : timers_) {
+			float avg = 0.0f, max = 0.0f;
+			for (float ms : timer.history) {
+				avg += ms;
+				max = std::max(max, ms);
+			}
+			avg /= kHistorySize;
+
+			std::string label = (timer.gpu ? "[gpu] " : "[cpu] ") + timer.name;
+			char overlay[64];
+			snprintf(overlay, sizeof(overlay), "avg %.3f ms, max %.3f ms", avg, max);
+
+			ImGui::PlotLines(label.c_str(), timer.history.data(), kHistorySize, history_index_, overlay, 0.0f, max * 1.2f + 0.001f, ImVec2(0, 40));
+		}
+
+		if (ImGui::Button("Export CSV")) exportCsv("profile.csv");
+		ImGui::SameLine();
+		if (ImGui::Button("Export Chrome Trace")) exportChromeTrace("profile.json");
+	}
+
+	// one row per frame, one column per timer
+	bool exportCsv(const std::string& path) const {
+		std::ofstream out(path);
+		if (!out) {
+			std::cerr << "cannot open file " << path << std::endl;
+			return false;
+		}
+
+		out << "frame_offset";
+		for (const Timer& timer : timers_) out << "," << timer.name << (timer.gpu ? " (gpu ms)" : " (cpu ms)");
+		out << "\n";
+
+		for (unsigned int i = 0; i < kHistorySize; i++) {
+			unsigned int index = (history_index_ + i) % kHistorySize; // oldest first
+			out << int(i) - int(kHistorySize);
+			for (const Timer& timer : timers_) out << "," << timer.history[index];
+			out << "\n";
+		}
+
+		std::cout << "profile written to " << path << std::endl;
+		return true;
+	}
+
+	// chrome://tracing / Perfetto compatible event list, CPU scopes on thread 0 and GPU passes on thread 1
+	bool exportChromeTrace(const std::string& path) const {
+		std::ofstream out(path);
+		if (!out) {
+			std::cerr << "cannot open file " << path << std::endl;
+			return false;
+		}
+
+		out << "{\"traceEvents\":[\n";
+		bool first = true;
+		for (const Frame& frame : frames_) {
+			for (const Event& event : frame.events) {
+				const Timer& timer = timers_[event.timer];
+				if (!first) out << ",\n";
+				first = false;
+
+				out << "{\"name\":\"" << timer.name << "\",\"cat\":\"" << (timer.gpu ? "gpu" : "cpu")
+					<< "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << (timer.gpu ? 1 : 0)
+					<< ",\"ts\":" << std::fixed << event.start_us << ",\"dur\":" << event.duration_us
+					<< ",\"args\":{\"frame\":" << frame.number << "}}";
+			}
+		}
+		out << "\n]}\n";
+
+		std::cout << "trace written to " << path << std::endl;
+		return true;
+	}
+
+private:
+	struct Event {
+		int timer;
+		double start_us;
+		double duration_us;
+	};
+
+	struct Frame {
+		unsigned int number;
+		double start_us;
+		std::vector<Event> events;
+		double gpu_cursor_us; // end of the GPU passes laid out so far
+	};
+
+	std::vector<Timer> timers_;
+	std::deque<Frame> frames_;
+	unsigned int frame_number_ = 1;
+	int history_index_ = 0;
+
+	int querySlot_() const {
+		return int(frames_.back().number % kQueryFrames);
+	}
+
+	// the GPU passes run back to back, they are laid out on their own track from the start of their frame
+	void addGpuEvent_(int timer, unsigned int frame_number, double duration_us) {
+		for (Frame& frame : frames_) {
+			if (frame.number != frame_number) continue;
+			frame.events.push_back({ timer, frame.gpu_cursor_us, duration_us });
+			frame.gpu_cursor_us += duration_us;
+			return;
+		}
+	}
+
+	int findOrCreate_(const char* name, bool gpu) {
+		for (int i = 0; i < timers_.size(); i++)
+			if (timers_[i].name == name) return i;
+
+		Timer timer;
+		timer.name = name;
+		timer.gpu = gpu;
+		if (gpu) glGenQueries(kQueryFrames, timer.queries);
+
+		timers_.push_back(timer);
+		return timers_.size() - 1;
+	}
+
+	void pushSample_(Timer& timer, float ms) {
+		timer.last_ms = ms;
+		timer.history[history_index_] = ms;
+	}
+
+	static double nowUs_() {
+		using namespace std::chrono;
+		return duration<double, std::micro>(steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+#endif
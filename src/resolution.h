@@ -0,0 +1,68 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Scales the path tracing resolution to keep the measured GPU frame time around a target budget
+class ResolutionController
+{
+public:
+	bool enabled = false;
+	float target_ms = 16.6f;
+	float min_scale = 0.5f;
+	float max_scale = 1.0f;
+
+	// render scale relative to the window, also the fixed scale when the controller is disabled
+	float scale = 1.0f;
+
+	// smoothed GPU time of the passes that scale with resolution
+	float gpu_ms = 0.0f;
+	// latest unsmoothed measurement
+	float last_gpu_ms = 0.0f;
+
+	// scales are snapped to steps of this size so the target pool can reuse previous sizes
+	const float kScaleStep = 0.05f;
+	// frames to wait after a change before adjusting again, lets the new timings settle
+	const unsigned int kCooldownFrames = 10;
+
+	// feed the GPU time of the passes that scale with resolution once per frame
+	void update(float frame_gpu_ms) {
+		last_gpu_ms = frame_gpu_ms;
+		gpu_ms = gpu_ms == 0.0f ? last_gpu_ms : glm::mix(gpu_ms, last_gpu_ms, 0.1f);
+
+		adjustScale_();
+	}
+
+	glm::ivec2 renderSize(int window_width, int window_height) const {
+		return glm::max(glm::ivec2(glm::round(glm::vec2(window_width, window_height) * scale)), glm::ivec2(1));
+	}
+
+private:
+	unsigned int cooldown_ = 0;
+
+	void adjustScale_() {
+		if (!enabled) return;
+
+		if (cooldown_ > 0) {
+			cooldown_--;
+			return;
+		}
+
+		// dead zone around the target to avoid oscillating between two steps
+		if (gpu_ms < target_ms * 1.05f && gpu_ms > target_ms * 0.85f) return;
+
+		// cost is roughly proportional to the pixel count, which goes with scale squared
+		float wanted = scale * glm::sqrt(target_ms / glm::max(gpu_ms, 0.01f));
+		wanted = glm::clamp(wanted, scale * 0.75f, scale * 1.1f); // drop fast, recover slowly
+		wanted = glm::round(wanted / kScaleStep) * kScaleStep;
+		wanted = glm::clamp(wanted, min_scale, max_scale);
+
+		if (wanted != scale) {
+			scale = wanted;
+			cooldown_ = kCooldownFrames;
+		}
+	}
+};
+
+#endif
@@ -7,6 +7,12 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+
+// preprocessor defines injected into a shader's source, ordered so equal sets produce the same source
+typedef std::map<std::string, std::string> ShaderDefines;
 
 class Shader
 {
@@ -14,7 +20,7 @@ public:
     unsigned int ID;
     // constructor generates the shader on the fly
     // ------------------------------------------------------------------------
-    Shader(const char* vertex_path, const char* fragment_path)
+    Shader(const char* vertex_path, const char* fragment_path, const ShaderDefines& defines = ShaderDefines())
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertex_code;
@@ -44,6 +50,8 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
         }
+        vertex_code = injectDefines(vertex_code, defines);
+        fragment_code = injectDefines(fragment_code, defines);
         const char* v_shader_code = vertex_code.c_str();
         const char* f_shader_code = fragment_code.c_str();
         // 2. compile shaders
@@ -67,10 +75,13 @@ public:
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+
+        cacheUniformLocations_();
     }
 
     Shader(unsigned int id) {
         ID = id;
+        cacheUniformLocations_();
     }
 
     // activate the shader
@@ -83,82 +94,148 @@ public:
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
 
     void setUInt(const std::string& name, unsigned int x) const
     {
-        glUniform1ui(glGetUniformLocation(ID, name.c_str()), x);
+        glUniform1ui(location(name), x);
     }
 
     void setUVec2(const std::string& name, unsigned int x, unsigned int y) const
     {
-        glUniform2ui(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2ui(location(name), x, y);
     }
 
     void setUVec3(const std::string& name, unsigned int x, unsigned int y, unsigned int z) const
     {
-        glUniform3ui(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3ui(location(name), x, y, z);
     }
 
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w) const
     {
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     void setTexture(const std::string& name, const unsigned int texture, const unsigned int slot) {
         glActiveTexture(GL_TEXTURE0 + slot);
         glBindTexture(GL_TEXTURE_2D, texture);
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), slot);
+        glUniform1i(location(name), slot);
+    }
+    // ------------------------------------------------------------------------
+    // binds a uniform block of this program to a uniform buffer binding point, does nothing if the block isn't used
+    void bindUniformBlock(const std::string& name, const unsigned int binding) const
+    {
+        unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+    // ------------------------------------------------------------------------
+    // inserts the defines right after the #version line, which has to stay first
+    static std::string injectDefines(const std::string& source, const ShaderDefines& defines)
+    {
+        if (defines.empty()) return source;
+
+        std::string define_lines;
+        for (const auto& define : defines)
+            define_lines += "#define " + define.first + " " + define.second + "\n";
+
+        size_t insert_at = 0;
+        size_t version = source.find("#version");
+        if (version != std::string::npos)
+        {
+            size_t line_end = source.find('\n', version);
+            insert_at = line_end == std::string::npos ? source.size() : line_end + 1;
+        }
+
+        // restore the line numbers of the rest of the file for the compile errors
+        std::string result = source;
+        result.insert(insert_at, define_lines + "#line " + std::to_string(std::count(source.begin(), source.begin() + insert_at, '\n') + 1) + "\n");
+        return result;
+    }
+    // ------------------------------------------------------------------------
+    // uniform locations are looked up once after linking, unknown (or optimized out) names give -1 which GL ignores
+    int location(const std::string& name) const
+    {
+        auto it = uniform_locations_.find(name);
+        return it != uniform_locations_.end() ? it->second : -1;
     }
 
 private:
+    std::unordered_map<std::string, int> uniform_locations_;
+
+    void cacheUniformLocations_()
+    {
+        int count = 0, max_length = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+        std::string name(max_length, '\0');
+        for (int i = 0; i < count; i++)
+        {
+            int length, size;
+            unsigned int type;
+            glGetActiveUniform(ID, i, max_length, &length, &size, &type, &name[0]);
+
+            std::string uniform_name = name.substr(0, length);
+            int location = glGetUniformLocation(ID, uniform_name.c_str());
+            if (location == -1) continue; // uniform block member
+
+            uniform_locations_[uniform_name] = location;
+
+            // arrays are reported as "name[0]", also allow setting them by their plain name
+            size_t bracket = uniform_name.find('[');
+            if (bracket != std::string::npos)
+                uniform_locations_[uniform_name.substr(0, bracket)] = location;
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors_(unsigned int shader, std::string type)
@@ -185,4 +262,35 @@ private:
         }
     }
 };
+
+// a uniform buffer shared between programs through a binding point, see Shader::bindUniformBlock
+class UniformBuffer
+{
+public:
+    unsigned int ID = 0;
+    unsigned int binding = 0;
+
+    void create(size_t size, unsigned int binding_point)
+    {
+        binding = binding_point;
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void update(const void* data, size_t size) const
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void destroy()
+    {
+        glDeleteBuffers(1, &ID);
+        ID = 0;
+    }
+};
 #endif
\ No newline at end of file
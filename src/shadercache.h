@@ -0,0 +1,327 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "shader.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// the loader is generated for GL 4.0 without extensions, program binaries (4.1) and parallel compile are loaded here
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Builds shader permutations (a source pair plus injected defines) without blocking the render loop where the
+// driver allows it, and persists linked programs so later launches skip the GLSL compile entirely.
+// Binaries are keyed by a hash of the final sources and the driver, a driver update just misses the cache.
+class ProgramCache
+{
+public:
+	enum State {
+		PENDING = 0,
+		READY,
+		FAILED,
+	};
+
+	// startup numbers for the debug window
+	unsigned int cache_hits = 0;
+	unsigned int cache_misses = 0;
+	float last_build_ms = 0.0f;
+
+	void init(GLADloadproc load, const std::string& cache_folder = "shadercache/") {
+		cache_folder_ = cache_folder;
+
+		driver_ = std::string((const char*)glGetString(GL_VENDOR)) + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION);
+
+		get_program_binary_ = (GetProgramBinaryProc)load("glGetProgramBinary");
+		program_binary_ = (ProgramBinaryProc)load("glProgramBinary");
+		program_parameteri_ = (ProgramParameteriProc)load("glProgramParameteri");
+
+		int binary_formats = 0;
+		if (get_program_binary_ && program_binary_ && program_parameteri_)
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binary_formats);
+		binaries_ = binary_formats > 0;
+
+		MaxShaderCompilerThreadsProc max_threads = nullptr;
+		if (hasExtension_("GL_KHR_parallel_shader_compile"))
+			max_threads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsKHR");
+		else if (hasExtension_("GL_ARB_parallel_shader_compile"))
+			max_threads = (MaxShaderCompilerThreadsProc)load("glMaxShaderCompilerThreadsARB");
+
+		parallel_ = max_threads != nullptr;
+		if (parallel_) max_threads(0xFFFFFFFF); // let the driver pick the thread count
+
+		if (binaries_) makeFolder_(cache_folder_);
+	}
+
+	bool parallelCompile() const { return parallel_; }
+	bool programBinaries() const { return binaries_; }
+
+	// starts building the permutation and returns its handle, requesting an existing permutation is free
+	int request(const char* vertex_path, const char* fragment_path, const ShaderDefines& defines = ShaderDefines()) {
+		std::string key = std::string(vertex_path) + "|" + fragment_path;
+		for (const auto& define : defines) key += "|" + define.first + "=" + define.second;
+
+		for (int i = 0; i < variants_.size(); i++)
+			if (variants_[i]->key == key) return i;
+
+		variants_.push_back(std::unique_ptr<Variant>(new Variant()));
+		Variant& variant = *variants_.back();
+		variant.key = key;
+		variant.start_us = nowUs_();
+
+		std::string vertex_code = Shader::injectDefines(readFile_(vertex_path), defines);
+		std::string fragment_code = Shader::injectDefines(readFile_(fragment_path), defines);
+		variant.hash = hash_(vertex_code + '\0' + fragment_code + '\0' + driver_);
+
+		if (binaries_ && loadBinary_(variant)) {
+			cache_hits++;
+			return variants_.size() - 1;
+		}
+		cache_misses++;
+
+		variant.vertex = compile_(GL_VERTEX_SHADER, vertex_code);
+		variant.fragment = compile_(GL_FRAGMENT_SHADER, fragment_code);
+
+		variant.program = glCreateProgram();
+		glAttachShader(variant.program, variant.vertex);
+		glAttachShader(variant.program, variant.fragment);
+		if (binaries_) program_parameteri_(variant.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(variant.program); // returns right away, the status queries are what blocks
+
+		return variants_.size() - 1;
+	}
+
+	// finishes the builds the driver completed, call once per frame. without parallel compile support
+	// querying a build blocks until it's done, so only one build is finished per call
+	void poll() {
+		for (auto& variant : variants_) {
+			if (variant->state != PENDING) continue;
+
+			if (parallel_) {
+				int done = GL_FALSE;
+				glGetProgramiv(variant->program, GL_COMPLETION_STATUS_KHR, &done);
+				if (!done) continue;
+				finish_(*variant);
+			}
+			else {
+				finish_(*variant);
+				return;
+			}
+		}
+	}
+
+	State state(int handle) const {
+		return variants_[handle]->state;
+	}
+
+	bool isReady(int handle) const {
+		return variants_[handle]->state == READY;
+	}
+
+	// blocks until the permutation is built, for programs needed before the first frame
+	Shader& wait(int handle) {
+		Variant& variant = *variants_[handle];
+		if (variant.state == PENDING) finish_(variant);
+		return *variant.shader;
+	}
+
+	Shader& get(int handle) {
+		return *variants_[handle]->shader;
+	}
+
+	void destroy() {
+		for (auto& variant : variants_) {
+			if (variant->state == PENDING) {
+				glDeleteShader(variant->vertex);
+				glDeleteShader(variant->fragment);
+			}
+			glDeleteProgram(variant->program);
+		}
+		variants_.clear();
+	}
+
+private:
+	typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei buf_size, GLsizei* length, GLenum* binary_format, void* binary);
+	typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binary_format, const void* binary, GLsizei length);
+	typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+	typedef void (APIENTRYP MaxShaderCompilerThreadsProc)(GLuint count);
+
+	struct Variant {
+		std::string key;
+		unsigned long long hash = 0;
+		State state = PENDING;
+
+		unsigned int vertex = 0, fragment = 0;
+		unsigned int program = 0;
+		std::unique_ptr<Shader> shader;
+
+		double start_us = 0.0;
+	};
+
+	std::vector<std::unique_ptr<Variant>> variants_;
+	std::string cache_folder_;
+	std::string driver_;
+	bool parallel_ = false;
+	bool binaries_ = false;
+
+	GetProgramBinaryProc get_program_binary_ = nullptr;
+	ProgramBinaryProc program_binary_ = nullptr;
+	ProgramParameteriProc program_parameteri_ = nullptr;
+
+	void finish_(Variant& variant) {
+		int success = 0;
+		glGetProgramiv(variant.program, GL_LINK_STATUS, &success);
+
+		if (!success) {
+			printLog_(variant.vertex, false);
+			printLog_(variant.fragment, false);
+			printLog_(variant.program, true);
+		}
+
+		glDetachShader(variant.program, variant.vertex);
+		glDetachShader(variant.program, variant.fragment);
+		glDeleteShader(variant.vertex);
+		glDeleteShader(variant.fragment);
+		variant.vertex = variant.fragment = 0;
+
+		if (success && binaries_) saveBinary_(variant);
+
+		// failed programs still get a Shader so callers can keep going like with a failed Shader constructor
+		variant.shader = std::unique_ptr<Shader>(new Shader(variant.program));
+		variant.state = success ? READY : FAILED;
+		last_build_ms = float((nowUs_() - variant.start_us) / 1000.0);
+	}
+
+	unsigned int compile_(GLenum type, const std::string& code) {
+		const char* source = code.c_str();
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &source, NULL);
+		glCompileShader(shader);
+		return shader;
+	}
+
+	bool loadBinary_(Variant& variant) {
+		std::ifstream file(binaryPath_(variant), std::ios::binary);
+		if (!file) return false;
+
+		GLenum format = 0;
+		if (!file.read((char*)&format, sizeof(format))) return false;
+		std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (binary.empty()) return false;
+
+		variant.program = glCreateProgram();
+		program_binary_(variant.program, format, binary.data(), (GLsizei)binary.size());
+
+		int success = 0;
+		glGetProgramiv(variant.program, GL_LINK_STATUS, &success);
+		if (!success) { // stale or rejected by the driver, rebuild from source
+			glDeleteProgram(variant.program);
+			variant.program = 0;
+			return false;
+		}
+
+		variant.shader = std::unique_ptr<Shader>(new Shader(variant.program));
+		variant.state = READY;
+		last_build_ms = float((nowUs_() - variant.start_us) / 1000.0);
+		return true;
+	}
+
+	void saveBinary_(const Variant& variant) {
+		int length = 0;
+		glGetProgramiv(variant.program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		get_program_binary_(variant.program, length, NULL, &format, binary.data());
+
+		std::ofstream file(binaryPath_(variant), std::ios::binary);
+		if (!file) {
+			std::cerr << "cannot open file " << binaryPath_(variant) << std::endl;
+			return;
+		}
+		file.write((const char*)&format, sizeof(format));
+		file.write(binary.data(), binary.size());
+	}
+
+	std::string binaryPath_(const Variant& variant) const {
+		char name[32];
+		snprintf(name, sizeof(name), "%016llx.bin", variant.hash);
+		return cache_folder_ + name;
+	}
+
+	void printLog_(unsigned int object, bool program) const {
+		char info_log[1024];
+		if (program) glGetProgramInfoLog(object, 1024, NULL, info_log);
+		else glGetShaderInfoLog(object, 1024, NULL, info_log);
+		if (info_log[0]) std::cout << "ERROR::" << (program ? "PROGRAM_LINKING_ERROR" : "SHADER_COMPILATION_ERROR") << "\n" << info_log << std::endl;
+	}
+
+	static std::string readFile_(const char* path) {
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+			return "";
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+		return stream.str();
+	}
+
+	// FNV-1a
+	static unsigned long long hash_(const std::string& data) {
+		unsigned long long hash = 14695981039346656037ull;
+		for (unsigned char c : data) {
+			hash ^= c;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	static bool hasExtension_(const char* name) {
+		int count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (int i = 0; i < count; i++)
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+		return false;
+	}
+
+	static void makeFolder_(const std::string& path) {
+#ifdef _WIN32
+		_mkdir(path.c_str());
+#else
+		mkdir(path.c_str(), 0755);
+#endif
+	}
+
+	static double nowUs_() {
+		using namespace std::chrono;
+		return duration<double, std::micro>(steady_clock::now().time_since_epoch()).count();
+	}
+};
+
+#endif
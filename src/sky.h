@@ -0,0 +1,74 @@
+#ifndef SKY_H
+#define SKY_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <vector>
+#include <cmath>
+
+namespace sky {
+	// procedural sky and sun, the defaults reproduce the sky the path tracer always had
+	struct Parameters {
+		float sun_azimuth = 45.0f; // degrees around +y, from +x towards +z
+		float sun_elevation = 54.74f; // degrees above the horizon, (1, 2, 1) normalized
+		float sun_intensity = 70.0f;
+		glm::vec3 sun_color = glm::vec3(1.0f, 0.8f, 0.4f);
+		float sun_exponent = 200.0f; // the sun is a pow(cos, exponent) lobe around its direction
+		float sky_intensity = 1.0f;
+
+		glm::vec3 sunDirection() const {
+			float azimuth = glm::radians(sun_azimuth), elevation = glm::radians(sun_elevation);
+			return glm::vec3(std::cos(elevation) * std::cos(azimuth), std::sin(elevation), std::cos(elevation) * std::sin(azimuth));
+		}
+
+		glm::vec3 sunRadiance() const {
+			return sun_color * sun_intensity;
+		}
+	};
+
+	// sky radiance without the sun
+	glm::vec3 radiance(const glm::vec3& dir, const Parameters& params) {
+		glm::vec3 sky = glm::clamp(glm::exp2(-dir.y / glm::vec3(0.35f, 0.45f, 0.6f)), 0.0f, 1.0f);
+		return sky * params.sky_intensity;
+	}
+
+	// equirectangular LUT of the sky without the sun: u is the azimuth atan2(z, x), v the angle from +y.
+	// the sun lobe is far too narrow for a small LUT, the shader evaluates (and samples) it analytically
+	void bakeLut(unsigned int texture, int width, int height, unsigned int slot, const Parameters& params) {
+		std::vector<float> data(width * height * 3);
+
+		for (int y = 0; y < height; y++) for (int x = 0; x < width; x++) {
+			float phi = ((x + 0.5f) / width - 0.5f) * 6.2831853f;
+			float theta = (y + 0.5f) / height * 3.1415927f;
+
+			glm::vec3 dir(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			glm::vec3 color = radiance(dir, params);
+
+			float* texel = &data[(y * width + x) * 3];
+			texel[0] = color.r;
+			texel[1] = color.g;
+			texel[2] = color.b;
+		}
+
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, width, height, 0, GL_RGB, GL_FLOAT, data.data());
+	}
+
+	// the azimuth wraps around, the poles clamp
+	unsigned int createLut(int width, int height, unsigned int slot, const Parameters& params) {
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		bakeLut(texture, width, height, slot, params);
+		return texture;
+	}
+}
+
+#endif
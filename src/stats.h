@@ -0,0 +1,203 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <glad/glad.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "gbuffer.h"
+
+// Double buffered asynchronous readback of one attachment of a render target. The data of a frame is
+// handed to the reduce callback a frame later, once the copy finished, so the readback never stalls.
+class PixelReadback
+{
+public:
+	void destroy() {
+		glDeleteBuffers(2, pbos_);
+		pbos_[0] = pbos_[1] = 0;
+	}
+
+	// drops the readbacks in flight, their data never reaches reduce
+	void discard() {
+		pending_[0] = pending_[1] = false;
+	}
+
+	// reduce(const void* data, int width, int height) gets the previous readback. level reads a mip level of the
+	// attachment, which has to be mipmapped already
+	template<typename Reduce>
+	void update(const gbuffer::RenderTarget* target, int attachment, GLenum format, GLenum type, unsigned int bytes_per_pixel, Reduce reduce, int level = 0) {
+		if (!pbos_[0]) glGenBuffers(2, pbos_);
+
+		int prev = 1 - index_;
+		if (pending_[prev]) {
+			pending_[prev] = false;
+
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos_[prev]);
+			const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, sizes_[prev], GL_MAP_READ_BIT);
+			if (data) reduce(data, widths_[prev], heights_[prev]);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+
+		if (!target || !target->textures[attachment]) return;
+
+		int width = std::max(target->width >> level, 1), height = std::max(target->height >> level, 1);
+		size_t size = size_t(width) * height * bytes_per_pixel;
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, target->fbo);
+		glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+		if (level) glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, GL_TEXTURE_2D, target->textures[attachment], level);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos_[index_]);
+		if (size != sizes_[index_]) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			sizes_[index_] = size;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, format, type, 0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (level) glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + attachment, GL_TEXTURE_2D, target->textures[attachment], 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		widths_[index_] = width;
+		heights_[index_] = height;
+		pending_[index_] = true;
+		index_ = prev;
+	}
+
+private:
+	unsigned int pbos_[2] = { 0 };
+	size_t sizes_[2] = { 0 };
+	int widths_[2] = { 0 }, heights_[2] = { 0 };
+	bool pending_[2] = { false };
+	int index_ = 0;
+};
+
+// Reduces the per pixel traversal counters of a frame to aggregate numbers, one frame late (see PixelReadback)
+class TraversalStats
+{
+public:
+	float mean_steps = 0.0f;
+	unsigned int p95_steps = 0;
+	unsigned int max_steps = 0;
+	unsigned long long total_rays = 0;
+
+	// steps above this go into the last histogram bin, only the p95 is approximate in that case
+	static const unsigned int kHistogramBins = 8192;
+
+	void destroy() {
+		readback_.destroy();
+	}
+
+	// collects the previous readback and starts one for this frame's target
+	void update(const gbuffer::RenderTarget* target) {
+		readback_.update(target, TRAVERSAL_TEXTURE, GL_RG_INTEGER, GL_UNSIGNED_INT, 2 * sizeof(uint32_t),
+			[this](const void* data, int width, int height) { reduce_((const uint32_t*)data, size_t(width) * height); });
+	}
+
+private:
+	PixelReadback readback_;
+	std::vector<unsigned int> histogram_ = std::vector<unsigned int>(kHistogramBins, 0);
+
+	void reduce_(const uint32_t* data, size_t pixels) {
+		unsigned long long steps_sum = 0, rays_sum = 0;
+		unsigned int max = 0;
+
+		std::fill(histogram_.begin(), histogram_.end(), 0);
+
+		for (size_t i = 0; i < pixels; i++) {
+			uint32_t steps = data[i * 2 + 0];
+			steps_sum += steps;
+			rays_sum += data[i * 2 + 1];
+			max = std::max(max, steps);
+			histogram_[std::min(steps, kHistogramBins - 1)]++;
+		}
+
+		// walk the histogram up to the 95th percentile
+		unsigned long long threshold = (unsigned long long)(pixels * 0.95), count = 0;
+		unsigned int p95 = 0;
+		while (p95 < kHistogramBins - 1 && (count += histogram_[p95]) < threshold) p95++;
+
+		mean_steps = pixels ? float(double(steps_sum) / pixels) : 0.0f;
+		p95_steps = p95;
+		max_steps = max;
+		total_rays = rays_sum;
+	}
+};
+
+// Noise estimate of the path traced radiance: the mean relative change of every pixel's luminance from the
+// previous frame. With a still camera it falls as the image converges, on a fixed camera path it compares
+// how noisy different settings look at the same frame count.
+class ConvergenceStats
+{
+public:
+	float mean_change = 0.0f;
+
+	void destroy() {
+		readback_.destroy();
+	}
+
+	void update(const gbuffer::RenderTarget* target) {
+		readback_.update(target, SCREEN_TEXTURE, GL_RGB, GL_FLOAT, 3 * sizeof(float),
+			[this](const void* data, int width, int height) { reduce_((const float*)data, width, height); });
+	}
+
+private:
+	PixelReadback readback_;
+	std::vector<float> last_luminance_;
+	int last_width_ = 0, last_height_ = 0;
+
+	void reduce_(const float* data, int width, int height) {
+		size_t pixels = size_t(width) * height;
+		bool comparable = width == last_width_ && height == last_height_;
+
+		last_luminance_.resize(pixels);
+		double change_sum = 0.0;
+
+		for (size_t i = 0; i < pixels; i++) {
+			float luminance = 0.2126f * data[i * 3 + 0] + 0.7152f * data[i * 3 + 1] + 0.0722f * data[i * 3 + 2];
+			if (comparable) change_sum += std::abs(luminance - last_luminance_[i]) / (std::max(luminance, last_luminance_[i]) + 0.01f);
+			last_luminance_[i] = luminance;
+		}
+
+		if (comparable && pixels) mean_change = float(change_sum / pixels);
+		last_width_ = width;
+		last_height_ = height;
+	}
+};
+
+// Average relative error of the accumulated radiance. The top level of the mipmapped moments target holds the
+// frame's mean sampling need (relative standard deviation over sqrt(history)) and the fraction of pixels that hit
+// geometry, which are read back a frame late (see PixelReadback). The sky has no error and doesn't count
+class ErrorEstimate
+{
+public:
+	float mean_error = -1.0f; // negative until a readback arrived
+
+	void destroy() {
+		readback_.destroy();
+	}
+
+	void reset() {
+		mean_error = -1.0f;
+		readback_.discard();
+	}
+
+	// the target's moments have to be mipmapped this frame
+	void update(const gbuffer::RenderTarget* target) {
+		int top_level = 0;
+		for (int size = std::max(target->width, target->height); size > 1; size /= 2) top_level++;
+
+		readback_.update(target, MOMENTS_TEXTURE, GL_RGBA, GL_FLOAT, 4 * sizeof(float), [this](const void* data, int width, int height) {
+			const float* moments = (const float*)data;
+			mean_error = moments[3] > 0.0f ? moments[2] / moments[3] : 0.0f;
+		}, top_level);
+	}
+
+private:
+	PixelReadback readback_;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#version 330 core
+
+out vec4 FragColor; // resolved color (rgb) and history length (a)
+
+in vec2 TexCoord;
+
+// per frame data shared by all passes, must match FrameData in main.cpp
+layout (std140) uniform FrameData {
+	mat4 CamRotation;
+	mat4 LastCamRotation;
+	vec3 CamPosition;
+	vec3 LastCamPosition;
+	uvec2 RenderResolution; // size of the full resolution targets, may be smaller than the window
+	uint FrameCount;
+	int UpscaleMode; // 0 - native, 1 - checkerboard (1/2 of the pixels per frame), 2 - interleaved (1/4)
+	int IndirectScale; // how many times lower the illumination resolution is
+	vec2 Jitter; // sub-pixel offset of this frame's primary rays, in screen coordinates
+	vec2 LastJitter;
+};
+
+uniform sampler2D CurrentTex; // post processed frame, at window resolution
+uniform sampler2D HistoryTex; // last resolved frame
+uniform sampler2D DepthTex; // full resolution first hit distances, negative for the sky
+
+uniform bool ResetHistory;
+uniform bool Still; // progressive accumulation, the history is exact and isn't clamped
+uniform float MaxHistory; // frames averaged, a new frame is blended in by at least 1/MaxHistory
+
+void main()
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 current = texelFetch(CurrentTex, pixel, 0).rgb;
+
+	if (ResetHistory) {
+		FragColor = vec4(current, 1.);
+		return;
+	}
+
+	// this pixel's first hit, through the jittered ray it was traced with
+	ivec2 renderPixel = ivec2((TexCoord*0.5+0.5)*vec2(RenderResolution));
+	vec2 coord = (vec2(renderPixel) + 0.5)/vec2(RenderResolution)*2. - 1. + Jitter;
+	float aspect = float(RenderResolution.x)/float(RenderResolution.y);
+	vec3 dir = normalize((CamRotation * vec4(coord.x*aspect, coord.y, 1.5, 0.)).xyz);
+
+	float depth = texelFetch(DepthTex, renderPixel, 0).r;
+	vec3 lastDir = depth > 0. ? normalize(CamPosition + dir*depth - LastCamPosition) : dir; // the sky only rotates
+
+	// the history is resolved, so it is reprojected without the jitter
+	vec3 local = (transpose(LastCamRotation) * vec4(lastDir, 0.)).xyz;
+	vec2 lastCoord = (local.xy/local.z*1.5)/vec2(aspect, 1.)*0.5 + 0.5;
+
+	if (local.z <= 0. || any(lessThan(lastCoord, vec2(0.))) || any(greaterThan(lastCoord, vec2(1.)))) {
+		FragColor = vec4(current, 1.);
+		return;
+	}
+
+	vec4 history = texture(HistoryTex, lastCoord);
+	// the weight stays capped while still: the current frame is already a running average of the path tracer, an
+	// uncapped 1/count would average that average again and stop following it. only the jittered edges need smoothing
+	float count = min(history.a + 1., MaxHistory);
+
+	// history outside the range of this frame's 3x3 neighbourhood is from a disoccluded or changed surface
+	if (!Still) {
+		ivec2 size = textureSize(CurrentTex, 0);
+		vec3 low = current, high = current;
+		for (int i = -1; i <= 1; i++){
+			for (int j = -1; j <= 1; j++){
+				vec3 neighbour = texelFetch(CurrentTex, clamp(pixel + ivec2(i, j), ivec2(0), size - 1), 0).rgb;
+				low = min(low, neighbour);
+				high = max(high, neighbour);
+			}
+		}
+		history.rgb = clamp(history.rgb, low, high);
+	}
+
+	FragColor = vec4(mix(history.rgb, current, 1./count), count);
+}
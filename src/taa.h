@@ -0,0 +1,133 @@
+#ifndef TAA_H
+#define TAA_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <iostream>
+#include "gbuffer.h"
+#include "shader.h"
+
+// Temporal anti-aliasing: the primary rays are jittered by a sub-pixel Halton offset every frame and the post
+// processed frames are blended into a window sized history, so edges get supersampled over time
+class TemporalAA
+{
+public:
+	static const unsigned int kJitterPhases = 16;
+
+	float max_history = 10.0f; // frames averaged, a new frame is blended in by 1/max_history
+
+	// sub-pixel offset of a frame's primary rays, in pixels in [-0.5, 0.5)
+	static glm::vec2 jitter(unsigned int frame) {
+		unsigned int index = frame % kJitterPhases + 1; // the first point of the sequence is 0, 0
+		return glm::vec2(halton_(index, 2), halton_(index, 3)) - 0.5f;
+	}
+
+	// (re)creates the targets at the window size, the history starts over after a resize
+	void resize(int width, int height) {
+		if (width == width_ && height == height_) return;
+		destroy();
+
+		width_ = width;
+		height_ = height;
+
+		// the input is a single frame, the histories accumulate and keep their length in the alpha
+		const gbuffer::TargetFormat history_format = { GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, 8 };
+		createTarget_(&input_fbo_, &input_tex_, gbuffer::kFrameColorFormat);
+		for (int i = 0; i < 2; i++) createTarget_(&history_fbos_[i], &history_texs_[i], history_format);
+	}
+
+	void invalidate() {
+		history_valid_ = false;
+	}
+
+	bool historyValid() const {
+		return history_valid_;
+	}
+
+	// the post processing pass renders into this instead of the window
+	unsigned int inputFbo() const {
+		return input_fbo_;
+	}
+
+	// blends the post processed frame into the history. 'still' frames (progressive accumulation) blend in by the
+	// same capped weight but don't clamp the history, the camera didn't move so it is exact
+	void resolve(Shader& shader, const gbuffer::RenderTarget* primary_target, bool still, unsigned int vao) {
+		int next = 1 - current_;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, history_fbos_[next]);
+		glViewport(0, 0, width_, height_);
+
+		// the g-buffer units are bound again by every pass that reads them, so they are free to use here
+		shader.use();
+		shader.setTexture("CurrentTex", input_tex_, kBufferTextureSlot + SCREEN_TEXTURE);
+		shader.setTexture("HistoryTex", history_texs_[current_], kBufferTextureSlot + HISTORY_EMISSION_TEXTURE);
+		shader.setTexture("DepthTex", primary_target->textures[DEPTH_TEXTURE], kBufferTextureSlot + DEPTH_TEXTURE);
+		shader.setBool("ResetHistory", !history_valid_);
+		shader.setBool("Still", still);
+		shader.setFloat("MaxHistory", max_history);
+
+		glBindVertexArray(vao);
+		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+		current_ = next;
+		history_valid_ = true;
+	}
+
+	// copies the resolved frame to the window
+	void present() {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, history_fbos_[current_]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+		glBlitFramebuffer(0, 0, width_, height_, 0, 0, width_, height_, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void destroy() {
+		glDeleteFramebuffers(1, &input_fbo_);
+		glDeleteFramebuffers(2, history_fbos_);
+		glDeleteTextures(1, &input_tex_);
+		glDeleteTextures(2, history_texs_);
+
+		input_fbo_ = input_tex_ = 0;
+		history_fbos_[0] = history_fbos_[1] = history_texs_[0] = history_texs_[1] = 0;
+		width_ = height_ = 0;
+		history_valid_ = false;
+	}
+
+private:
+	unsigned int input_fbo_ = 0, input_tex_ = 0;
+	unsigned int history_fbos_[2] = { 0 }, history_texs_[2] = { 0 }; // the alpha holds the history length
+	int current_ = 0;
+	int width_ = 0, height_ = 0;
+	bool history_valid_ = false;
+
+	void createTarget_(unsigned int* fbo, unsigned int* texture, const gbuffer::TargetFormat& format) {
+		glGenTextures(1, texture);
+		glActiveTexture(GL_TEXTURE0 + kBufferTextureSlot);
+		glBindTexture(GL_TEXTURE_2D, *texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format.internal_format, width_, height_, 0, format.format, format.type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, *fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *texture, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	static float halton_(unsigned int index, unsigned int base) {
+		float result = 0.0f, fraction = 1.0f;
+		for (; index > 0; index /= base) {
+			fraction /= base;
+			result += fraction * (index % base);
+		}
+		return result;
+	}
+};
+
+#endif